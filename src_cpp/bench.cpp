@@ -0,0 +1,430 @@
+// I/O path benchmarks for the src_cpp tools (POSIX).
+//
+// Kernels: the byte transforms and CRC32C from xform.h / crc32c.h, timed
+// in-process for every ISA level the CPU supports, at several buffer sizes,
+// in GB/s.
+//
+// End to end: generates inputs in a scratch directory, then times the built
+// tools and prints the best-of-N throughput for each case. Tools are run
+// with fork/exec, never through a shell, so --dir and tool paths may hold
+// any character.
+//  - "io": cat file->file/pipe/null per copy strategy on the largest input.
+//  - "crossover": one file of each size copied many times with --copy=read
+//    and --copy=mmap, to see whether mapping ever beats the read loop. cat's
+//    --copy=auto never maps: with IoBufSize buffers it has not so far.
+//  - "e2e": cat and cipher on inputs from 1 MB up to --size (1, 16, 256,
+//    1024, 4096 MB), with warm and cold page cache. Cold runs evict the
+//    input with posix_fadvise(DONTNEED) before every repetition, which
+//    needs no privileges, unlike drop_caches.
+//  - "rust": the same e2e runs for src_rst/cat.rs and caesar_cipher.rs,
+//    built with rustc -O, as a reference baseline. Skipped if rustc fails.
+//  - "durability": cipher once per --durability mode, on the large file and
+//    as a batch over the small files, to show what each level of sync costs.
+//
+// --json FILE writes every result as one JSON object per line inside an
+// array, so two runs can be diffed.
+//
+//   bench [--size MB] [--reps N] [--dir DIR] [--cat PATH] [--cipher PATH] [--files N]
+//         [--rust SRCDIR] [--json FILE] [--only all|kernels|e2e]
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "crc32c.h"
+#include "xform.h"
+
+typedef std::vector<std::string> Argv;
+
+struct Case {
+    std::string group;
+    std::string name;
+    std::vector<Argv> cmd;  // pipeline: each stage's stdout feeds the next
+    std::string out;    // the last stage's stdout
+    long long bytes;    // input volume, for MB/s
+    std::string cold;   // input to evict from the page cache before each run; empty = warm
+};
+
+struct KernelResult {
+    std::string kernel;
+    std::string isa;
+    size_t buffer;
+    double gbs;
+};
+
+static void MakeBlock(unsigned char* block, size_t n) {
+    unsigned int x = 2463534242u;                   // xorshift32: cheap, incompressible
+    for (size_t i = 0; i < n; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        block[i] = (unsigned char)x;
+    }
+}
+
+static bool MakeInput(const std::string& path, long long bytes) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    std::vector<unsigned char> block(1 << 20);
+    MakeBlock(block.data(), block.size());
+    for (long long left = bytes; left > 0; left -= (long long)block.size()) {
+        size_t n = left < (long long)block.size() ? (size_t)left : block.size();
+        block[0]++;                                 // no two blocks identical
+        if (fwrite(block.data(), 1, n, f) != n) { fclose(f); return false; }
+    }
+    return fclose(f) == 0;
+}
+
+// Many small files, as produced by log rotation: sizes spread over 0..8 KB.
+static bool MakeSmallFiles(const std::string& dir, int count, long long* total) {
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    std::vector<unsigned char> block(8192, 'x');
+    for (int i = 0; i < count; i++) {
+        FILE* f = fopen((dir + "/f" + std::to_string(i)).c_str(), "wb");
+        if (!f) return false;
+        size_t n = (size_t)(i * 2654435761u) % block.size();
+        fwrite(block.data(), 1, n, f);
+        *total += (long long)n;
+        if (fclose(f) != 0) return false;
+    }
+    return true;
+}
+
+// Evict path's pages so the next read comes from the device.
+static void DropCache(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+// Runs cmd as a pipeline, the last stage writing to out (stderr to
+// /dev/null too if quiet); true if every stage exits 0. Arguments go
+// straight to execvp, so nothing in them is ever parsed by a shell.
+static bool RunPipeline(const std::vector<Argv>& cmd, const std::string& out, bool quiet = false) {
+    int outFd = open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int nullFd = quiet ? open("/dev/null", O_WRONLY) : -1;
+    if (outFd < 0 || (quiet && nullFd < 0)) {
+        if (outFd >= 0) close(outFd);
+        return false;
+    }
+    std::vector<pid_t> pids;
+    int in = -1;
+    bool ok = true;
+    for (size_t k = 0; k < cmd.size() && ok; k++) {
+        int p[2] = { -1, -1 };
+        bool last = k + 1 == cmd.size();
+        if (!last && pipe(p) != 0) {
+            ok = false;
+            break;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (in >= 0) dup2(in, STDIN_FILENO);
+            dup2(last ? outFd : p[1], STDOUT_FILENO);
+            if (quiet) dup2(nullFd, STDERR_FILENO);
+            for (int fd : { in, outFd, nullFd, p[0], p[1] })
+                if (fd > STDERR_FILENO) close(fd);
+            std::vector<char*> args;
+            for (const std::string& a : cmd[k]) args.push_back((char*)a.c_str());
+            args.push_back(NULL);
+            execvp(args[0], args.data());
+            _exit(127);
+        }
+        if (pid < 0) ok = false;
+        else pids.push_back(pid);
+        if (in >= 0) close(in);
+        if (p[1] >= 0) close(p[1]);
+        in = p[0];
+    }
+    if (in >= 0) close(in);
+    close(outFd);
+    if (nullFd >= 0) close(nullFd);
+    for (pid_t pid : pids) {
+        int status;
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = false;
+    }
+    return ok;
+}
+
+static double TimeCommand(const Case& c) {
+    auto t0 = std::chrono::steady_clock::now();
+    bool ok = RunPipeline(c.cmd, c.out);
+    auto t1 = std::chrono::steady_clock::now();
+    if (!ok) return -1.0;
+    return std::chrono::duration<double>(t1 - t0).count();
+}
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path) != 0 && errno != ENOENT ? -1 : 0;
+}
+
+// rm -rf without the shell: children first, symlinks not followed.
+static bool RemoveTree(const std::string& path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) return errno == ENOENT;
+    return nftw(path.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS) == 0;
+}
+
+// Best-of-3 GB/s for fn over a buffer of n bytes, repeated to ~256 MB.
+template <class Fn>
+static double TimeKernel(size_t n, Fn fn) {
+    size_t reps = (256u << 20) / n;
+    if (reps == 0) reps = 1;
+    double best = 0;
+    for (int t = 0; t < 3; t++) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < reps; r++) fn();
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        double gbs = (double)n * reps / s / 1e9;
+        if (gbs > best) best = gbs;
+    }
+    return best;
+}
+
+static void RunKernels(std::vector<KernelResult>* results) {
+    const XformIsa top = XformDetect();
+    static const unsigned char key[7] = { 3, 1, 4, 1, 5, 9, 2 };
+    std::vector<unsigned char> ks(448 + 64);            // lcm(7, 64) + 64, as Xform builds it
+    for (size_t j = 0; j < ks.size(); j++) ks[j] = key[j % 7];
+    const unsigned char* lut = XformTable<XformRot13Map>::lut.t;
+
+    printf("%-12s %-11s %10s %10s\n", "kernel", "isa", "buffer", "GB/s");
+    for (size_t n : { (size_t)4 << 10, (size_t)64 << 10, (size_t)1 << 20, (size_t)16 << 20 }) {
+        std::vector<unsigned char> in(n), out(n);
+        MakeBlock(in.data(), n);
+        volatile uint32_t sink = 0;
+        // Each ISA level that selects a kernel of its own; levels that fall
+        // back to the one below (e.g. Caesar on VBMI) are not repeated.
+        for (int isa = XFORM_SCALAR; isa <= top; isa++) {
+            XformIsa i = (XformIsa)isa, below = (XformIsa)(isa > 0 ? isa - 1 : 0);
+            CaesarFn caesar = CaesarKernel(i);
+            KeyedFn keyed = KeyedKernel<XformAddOp>(i);
+            TableFn table = TableKernel(i);
+            if (isa == XFORM_SCALAR || caesar != CaesarKernel(below))
+                results->push_back({ "caesar", xformIsaNames[isa], n,
+                                     TimeKernel(n, [&] { caesar(in.data(), out.data(), n, 77); }) });
+            if (isa == XFORM_SCALAR || keyed != KeyedKernel<XformAddOp>(below))
+                results->push_back({ "vigenere7", xformIsaNames[isa], n,
+                                     TimeKernel(n, [&] { keyed(in.data(), out.data(), n, ks.data(), 448, 0); }) });
+            if (isa == XFORM_SCALAR || table != TableKernel(below))
+                results->push_back({ "table", xformIsaNames[isa], n,
+                                     TimeKernel(n, [&] { table(lut, in.data(), out.data(), n); }) });
+        }
+        results->push_back({ "crc32c", "scalar", n, TimeKernel(n, [&] { sink = sink ^ Crc32cSwRaw(sink, in.data(), n); }) });
+#ifdef XFORM_X86
+        if (Crc32cHwAvailable())
+            results->push_back({ "crc32c", "sse4.2", n, TimeKernel(n, [&] { sink = sink ^ Crc32cHwRaw(sink, in.data(), n); }) });
+#endif
+    }
+    for (const KernelResult& k : *results)
+        printf("%-12s %-11s %10zu %10.2f\n", k.kernel.c_str(), k.isa.c_str(), k.buffer, k.gbs);
+}
+
+static std::string JsonString(const std::string& s) {
+    std::string q = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') q += '\\';
+        q += c;
+    }
+    return q + "\"";
+}
+
+int main(int argc, char* argv[]) {
+    long long sizeMB = 1024;
+    int reps = 3;
+    std::string dir = "/tmp";
+    std::string cat = "./cat";
+    std::string cipher = "./cipher";
+    std::string rust = "../src_rst";
+    std::string json;
+    std::string only = "all";
+    int smallFiles = 5000;
+
+    bool bad = false;
+    for (int i = 1; i < argc && !bad; i += 2) {
+        if (i + 1 == argc) bad = true;                  // an option without its value
+        else if (strcmp(argv[i], "--size") == 0) sizeMB = atoll(argv[i + 1]);
+        else if (strcmp(argv[i], "--reps") == 0) reps = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--dir") == 0) dir = argv[i + 1];
+        else if (strcmp(argv[i], "--cat") == 0) cat = argv[i + 1];
+        else if (strcmp(argv[i], "--cipher") == 0) cipher = argv[i + 1];
+        else if (strcmp(argv[i], "--files") == 0) smallFiles = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--rust") == 0) rust = argv[i + 1];
+        else if (strcmp(argv[i], "--json") == 0) json = argv[i + 1];
+        else if (strcmp(argv[i], "--only") == 0) only = argv[i + 1];
+        else bad = true;
+    }
+    if (bad || (only != "all" && only != "kernels" && only != "e2e")) {
+        printf("Usage: %s [--size MB] [--reps N] [--dir DIR] [--cat PATH] [--cipher PATH] [--files N]\n"
+               "       [--rust SRCDIR] [--json FILE] [--only all|kernels|e2e]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<KernelResult> kernels;
+    if (only != "e2e") RunKernels(&kernels);
+    const bool e2e = only != "kernels";
+
+    const std::string in = dir + "/bench_in.bin";
+    const std::string out = dir + "/bench_out.bin";
+    const std::string small = dir + "/bench_small";
+    const std::string smallOut = dir + "/bench_small_out";
+    const std::string manifest = dir + "/bench_manifest";
+    const long long bytes = sizeMB << 20;
+
+    if (e2e) printf("Generating %lld MB input in %s\n", sizeMB, dir.c_str());
+    if (e2e && !MakeInput(in, bytes)) {
+        printf("Cannot create %s\n", in.c_str());
+        return 1;
+    }
+    if (e2e) printf("Generating %d small files in %s\n", smallFiles, small.c_str());
+    long long smallBytes = 0;
+    if (e2e && !MakeSmallFiles(small, smallFiles, &smallBytes)) {
+        printf("Cannot create %s\n", small.c_str());
+        return 1;
+    }
+
+    std::vector<Case> cases;
+    std::vector<std::string> scratch;
+    for (const char* mode : { "read", "auto" }) {
+        if (!e2e) break;
+        std::string flag = std::string("--copy=") + mode;
+        cases.push_back({ "io", std::string("cat file->file  ") + mode, { { cat, flag, in } }, out, bytes, "" });
+        cases.push_back({ "io", std::string("cat file->pipe  ") + mode, { { cat, flag, in }, { cat, "--copy=auto" } },
+                          "/dev/null", bytes, "" });
+        cases.push_back({ "io", std::string("cat file->null  ") + mode, { { cat, flag, in } }, "/dev/null", bytes, "" });
+    }
+
+    std::string catRs = dir + "/bench_cat_rs", cipherRs = dir + "/bench_cipher_rs";
+    bool haveRust = e2e && RunPipeline({ { "rustc", "-O", "-o", catRs, rust + "/cat.rs" } }, "/dev/null", true)
+                        && RunPipeline({ { "rustc", "-O", "-o", cipherRs, rust + "/caesar_cipher.rs" } }, "/dev/null", true);
+    if (e2e && !haveRust) printf("rustc or %s unavailable: skipping Rust baselines\n", rust.c_str());
+    for (long long mb : { 1, 16, 256, 1024, 4096 }) {
+        if (!e2e || mb > sizeMB) break;
+        std::string path = mb == sizeMB ? in : dir + "/bench_e" + std::to_string(mb);
+        if (path != in) {
+            if (!MakeInput(path, mb << 20)) {
+                printf("Cannot create %s\n", path.c_str());
+                return 1;
+            }
+            scratch.push_back(path);
+        }
+        std::string size = std::to_string(mb) + "M ";
+        for (int cold = 0; cold < 2; cold++) {
+            std::string cache = cold ? "cold" : "warm";
+            std::string evict = cold ? path : "";
+            cases.push_back({ "e2e", "cat " + size + cache, { { cat, path } }, out, mb << 20, evict });
+            cases.push_back({ "e2e", "cipher " + size + cache, { { cipher, path, out, "3" } }, "/dev/null", mb << 20, evict });
+            if (!haveRust) continue;
+            cases.push_back({ "rust", "cat.rs " + size + cache, { { catRs, path } }, out, mb << 20, evict });
+            cases.push_back({ "rust", "caesar_cipher.rs " + size + cache, { { cipherRs, path, out, "3" } }, "/dev/null",
+                              mb << 20, evict });
+        }
+    }
+    if (haveRust) {
+        scratch.push_back(catRs);
+        scratch.push_back(cipherRs);
+    }
+
+    for (long long kb : { 4, 8, 16, 32, 64, 256, 1024, 4096, 16384, 65536 }) {
+        if (!e2e) break;
+        std::string path = dir + "/bench_x" + std::to_string(kb);
+        if (!MakeInput(path, kb << 10)) {
+            printf("Cannot create %s\n", path.c_str());
+            return 1;
+        }
+        long long copies = (64 << 10) / kb;             // ~64 MB per run, bounded argv
+        if (copies > 1000) copies = 1000;
+        if (copies < 1) copies = 1;
+        for (const char* mode : { "read", "mmap" }) {
+            Argv args = { cat, "--queue=0", std::string("--copy=") + mode };
+            args.insert(args.end(), (size_t)copies, path);
+            cases.push_back({ "crossover", "crossover " + std::to_string(kb) + "K " + mode, { args }, out,
+                              copies * (kb << 10), "" });
+        }
+        scratch.push_back(path);
+    }
+    for (const char* depth : { "0", "16" }) {
+        if (!e2e) break;
+        Argv args = { cat, std::string("--queue=") + depth };
+        for (int f = 0; f < smallFiles; f++) args.push_back(small + "/f" + std::to_string(f));
+        cases.push_back({ "io", std::string("cat small files q=") + depth, { args }, out, smallBytes, "" });
+    }
+
+    if (e2e) {                                          // manifest for the batch durability runs
+        FILE* m = fopen(manifest.c_str(), "w");
+        if (!m) {
+            printf("Cannot create %s\n", manifest.c_str());
+            return 1;
+        }
+        for (int i = 0; i < smallFiles; i++)
+            fprintf(m, "%s/f%d\t%s/f%d\t3\n", small.c_str(), i, smallOut.c_str(), i);   // tabs: --dir may hold spaces
+        if (fclose(m) != 0 || (mkdir(smallOut.c_str(), 0755) != 0 && errno != EEXIST)) {
+            printf("Cannot create %s\n", manifest.c_str());
+            return 1;
+        }
+    }
+    for (const char* mode : { "none", "data", "periodic", "full", "batch" }) {
+        if (!e2e) break;
+        std::string flag = std::string("--durability=") + mode;
+        cases.push_back({ "durability", std::string("cipher big ") + mode, { { cipher, flag, in, out, "3" } }, "/dev/null",
+                          bytes, "" });
+        cases.push_back({ "durability", std::string("cipher batch ") + mode, { { cipher, flag, "--batch=" + manifest } },
+                          "/dev/null", smallBytes, "" });
+    }
+
+    std::vector<double> bests;
+    if (!cases.empty()) printf("%-28s %10s %10s\n", "case", "best s", "MB/s");
+    for (const Case& c : cases) {
+        double best = -1.0;
+        for (int r = 0; r < reps; r++) {
+            if (!c.cold.empty()) DropCache(c.cold);
+            double t = TimeCommand(c);
+            if (t < 0) { best = -1.0; break; }
+            if (best < 0 || t < best) best = t;
+        }
+        bests.push_back(best);
+        if (best < 0) printf("%-28s %10s %10s\n", c.name.c_str(), "failed", "-");
+        else printf("%-28s %10.3f %10.1f\n", c.name.c_str(), best, (double)c.bytes / (1 << 20) / best);
+    }
+
+    if (!json.empty()) {
+        FILE* j = fopen(json.c_str(), "w");
+        if (!j) {
+            printf("Cannot create %s\n", json.c_str());
+            return 1;
+        }
+        const char* sep = "[\n";
+        for (const KernelResult& k : kernels) {
+            fprintf(j, "%s{\"group\": \"kernel\", \"kernel\": %s, \"isa\": %s, \"buffer\": %zu, \"gb_s\": %.3f}",
+                    sep, JsonString(k.kernel).c_str(), JsonString(k.isa).c_str(), k.buffer, k.gbs);
+            sep = ",\n";
+        }
+        for (size_t i = 0; i < cases.size(); i++) {
+            const Case& c = cases[i];
+            fprintf(j, "%s{\"group\": %s, \"case\": %s, \"bytes\": %lld, \"cache\": \"%s\", ",
+                    sep, JsonString(c.group).c_str(), JsonString(c.name).c_str(), c.bytes, c.cold.empty() ? "warm" : "cold");
+            if (bests[i] < 0) fprintf(j, "\"best_s\": null, \"mb_s\": null}");
+            else fprintf(j, "\"best_s\": %.6f, \"mb_s\": %.1f}", bests[i], (double)c.bytes / (1 << 20) / bests[i]);
+            sep = ",\n";
+        }
+        fprintf(j, "%s]\n", *sep == '[' ? "[" : "\n");
+        fclose(j);
+    }
+
+    if (!e2e) return 0;                                 // --only kernels created no files
+    remove(in.c_str());
+    remove(out.c_str());
+    for (const std::string& path : scratch) remove(path.c_str());
+    remove(manifest.c_str());
+    if (!RemoveTree(small) || !RemoveTree(smallOut)) return 1;
+    return 0;
+}
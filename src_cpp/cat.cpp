@@ -1,22 +1,180 @@
+#ifdef _WIN32
 #include <windows.h>
-#include <stdio.h>
 #include <tchar.h>
+#else
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <string.h>
+#include "iobuf.h"
+#include "xform.h"    /* XFORM_X86, XFORM_TARGET, XformDetect for the line-mode scanners */
+#include "iofile.h"   /* IoFile, IoRead/IoWriteSome, IoReportError; POSIX typedefs for the Win32 names */
+
+#define HANDOFF_MIN (1 << 20)    /* pipelined mode: files this large go to CatFile whole */
+#define MMAP_WINDOW (64 << 20)   /* bytes of the input mapped at any one time */
+/* mmap is opt-in (--copy=mmap). bench.cpp's read/mmap crossover sweep found
+ * mmap ahead from 16 KB up only against the old 512-byte loop; with IoBufSize
+ * buffers the read loop wins at every size from 16 KB to 64 MB (e.g. 2155 vs
+ * 1202 MB/s at 64 KB, 1306 vs 1016 MB/s at 64 MB), so there is no crossover
+ * for --copy=auto to switch at. */
+
+
+/* Copy strategies selectable with --copy=MODE. */
+#define COPY_AUTO 0     /* kernel-side copy, else buffered */
+#define COPY_READ 1     /* always use the buffered read/write loop */
+#define COPY_MMAP 2     /* map every named regular file, whatever its size */
+
+static int copyMode = COPY_AUTO;
+static int queueDepth = 16;     /* --queue=N; 0 processes files strictly one by one */
+static size_t bufOverride = 0;  /* --bufsize=N; 0 lets IoBufSize probe the handles */
+static BOOL directIO = FALSE;   /* --direct: keep bulk copies out of the page cache (iobuf.h) */
+static IoBufPool ioPool;
 
-#define BUF_SIZE 512
+/* Line modes, as in POSIX/GNU cat: -n numbers every output line, -b only
+ * non-empty ones (and wins over -n), -v shows control and high bytes as ^X
+ * and M-X, --squeeze-blank folds runs of empty lines into one. -s keeps its
+ * old meaning (suppress error messages), so squeezing has no short form.
+ * With any of them on, every byte written goes through CatLines. */
+static BOOL numberLines = FALSE, numberNonBlank = FALSE, showNonPrinting = FALSE, squeezeBlank = FALSE;
+static BOOL lineMode = FALSE;
 
-static void CatFile(HANDLE hIn, HANDLE hOut);
-static void ReportError(LPCTSTR msg, DWORD errCode, BOOL showErrMsg);
+/* --stats instrumentation. Each thread points tlsStats at the CatStats of
+ * the file it is currently reading or writing; with --stats off it stays
+ * NULL, so every probe in ReadChunk/WriteAll/KernelCopy costs one
+ * thread-local load and a predictable branch. Latencies go into log2
+ * buckets: bucket k counts calls that took [2^k, 2^(k+1)) ns. */
+#define HIST_BUCKETS 40
+
+struct CatStats {
+    unsigned long long bytes;           /* bytes that reached the output */
+    unsigned long long reads;           /* read calls */
+    unsigned long long writes;          /* write calls, kernel-side copies included */
+    unsigned long long shortWrites;     /* writes that moved less than asked */
+    unsigned long long kernelCopies;    /* copy_file_range/sendfile/splice calls */
+    double seconds;                     /* wall time spent on this file */
+    unsigned long long readHist[HIST_BUCKETS];
+    unsigned long long writeHist[HIST_BUCKETS];
+};
+
+static BOOL statsOn = FALSE;            /* --stats or --stats=FILE */
+static const TCHAR* statsPath = NULL;   /* --stats=FILE: JSON there instead of text on stderr */
+static thread_local CatStats* tlsStats = NULL;
+
+static long long StatClock() {
+    return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline long long StatStart() {
+    return tlsStats != NULL ? StatClock() : 0;
+}
+
+static void StatBucket(unsigned long long* hist, long long t0) {
+    long long ns = StatClock() - t0;
+    int k = 0;
+    while (k < HIST_BUCKETS - 1 && (1LL << (k + 1)) <= ns) k++;
+    hist[k]++;
+}
+
+static inline void StatRead(long long t0) {
+    if (tlsStats == NULL) return;
+    tlsStats->reads++;
+    StatBucket(tlsStats->readHist, t0);
+}
+
+static inline void StatWrite(long long t0, size_t asked, size_t done) {
+    if (tlsStats == NULL) return;
+    tlsStats->writes++;
+    tlsStats->bytes += done;
+    if (done < asked) tlsStats->shortWrites++;
+    StatBucket(tlsStats->writeHist, t0);
+}
+
+static inline void StatKernelCopy(long long t0, size_t done) {
+    if (tlsStats == NULL) return;
+    tlsStats->kernelCopies++;
+    StatWrite(t0, done, done);
+}
+
+static void ReportStats(TCHAR* names[], CatStats* stats, int n, double wall);
+
+static BOOL CatFile(HANDLE hIn, HANDLE hOut, BOOL named);
+static int KernelCopy(HANDLE hIn, HANDLE hOut);
+static int MapCopy(HANDLE hIn, HANDLE hOut);
+static void CatPipelined(TCHAR* files[], int nFiles, HANDLE hOut, BOOL dashS, CatStats* stats);
+static BOOL ReadChunk(HANDLE hIn, BYTE* buf, DWORD size, DWORD* nRead);
+static BOOL WriteAll(HANDLE hOut, const BYTE* buf, DWORD n);
+static BOOL PreferHandoff(HANDLE hIn);
+static BOOL WriteOut(HANDLE hOut, const BYTE* buf, DWORD n);
+static BOOL FlushOut(HANDLE hOut);
 
 int _tmain(int argc, TCHAR* argv[]) {
-    HANDLE hIn, hStdIn = GetStdHandle(STD_INPUT_HANDLE);
-    HANDLE hStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    HANDLE hStdIn = IoStdin(), hStdOut = IoStdout();
     BOOL dashS = FALSE;
     int iFirstFile = 1;
+    CatStats* stats = NULL;
+    long long tStart;
 
     /* Flow Step 1a: Parse Options */
     for (int i = 1; i < argc; i++) {
-        if (_tcscmp(argv[i], _T("-s")) == 0) {
-            dashS = TRUE;
+        if (argv[i][0] == _T('-') && argv[i][1] != _T('-') && argv[i][1] != 0) {
+            for (const TCHAR* c = argv[i] + 1; *c; c++) {   /* -s, -n, -b, -v, or bundled: -nv */
+                if (*c == _T('s')) dashS = TRUE;
+                else if (*c == _T('n')) numberLines = TRUE;
+                else if (*c == _T('b')) numberNonBlank = TRUE;
+                else if (*c == _T('v')) showNonPrinting = TRUE;
+            }
+            iFirstFile++;
+        }
+        else if (_tcscmp(argv[i], _T("--squeeze-blank")) == 0) {
+            squeezeBlank = TRUE;
+            iFirstFile++;
+        }
+        else if (_tcsncmp(argv[i], _T("--copy="), 7) == 0) {
+            if (_tcscmp(argv[i] + 7, _T("read")) == 0) copyMode = COPY_READ;
+            else if (_tcscmp(argv[i] + 7, _T("auto")) == 0) copyMode = COPY_AUTO;
+            else if (_tcscmp(argv[i] + 7, _T("mmap")) == 0) copyMode = COPY_MMAP;
+            else {
+                IoReportError(_T("Unknown --copy mode (expected auto, read or mmap)"), 0, FALSE);
+                return 1;
+            }
+            iFirstFile++;
+        }
+        else if (_tcsncmp(argv[i], _T("--bufsize="), 10) == 0) {
+            bufOverride = IoParseSize(argv[i] + 10);
+            if (bufOverride == 0) {
+                IoReportError(_T("Bad --bufsize (expected a size above 0, e.g. 65536, 64K or 1M)"), 0, FALSE);
+                return 1;
+            }
+            iFirstFile++;
+        }
+        else if (_tcscmp(argv[i], _T("--direct")) == 0) {
+            directIO = TRUE;
+            iFirstFile++;
+        }
+        else if (_tcscmp(argv[i], _T("--stats")) == 0) {
+            statsOn = TRUE;
+            iFirstFile++;
+        }
+        else if (_tcsncmp(argv[i], _T("--stats="), 8) == 0) {
+            statsOn = TRUE;
+            statsPath = argv[i] + 8;
+            iFirstFile++;
+        }
+        else if (_tcsncmp(argv[i], _T("--queue="), 8) == 0) {
+            queueDepth = _ttoi(argv[i] + 8);
+            if (queueDepth < 0) queueDepth = 0;
             iFirstFile++;
         }
         else if (argv[i][0] == _T('-')) {
@@ -27,57 +185,717 @@ int _tmain(int argc, TCHAR* argv[]) {
         }
     }
 
+    lineMode = numberLines || numberNonBlank || showNonPrinting || squeezeBlank;
+
+    /* Flow Step 1b: One stats slot per input (stdin counts as one) */
+    static TCHAR stdinName[] = _T("-");
+    TCHAR* stdinNames[1] = { stdinName };
+    TCHAR** names = iFirstFile >= argc ? stdinNames : argv + iFirstFile;
+    int nFiles = iFirstFile >= argc ? 1 : argc - iFirstFile;
+    if (statsOn) stats = new CatStats[nFiles]();
+    tStart = StatClock();
+
     /* Flow Step 2: Input Source Decision */
     if (iFirstFile >= argc) {
-        CatFile(hStdIn, hStdOut);
-        return 0;
+        tlsStats = stats;
+        CatFile(hStdIn, hStdOut, FALSE);
+        if (stats) stats[0].seconds = (StatClock() - tStart) / 1e9;
+    }
+
+    /* Flow Step 3a: Several files - overlap opening/reading with writing */
+    else if (queueDepth > 0 && nFiles > 1) {
+        CatPipelined(names, nFiles, hStdOut, dashS, stats);
     }
 
     /* Flow Step 3: File Processing Loop */
-    for (int i = iFirstFile; i < argc; i++) {
-        hIn = CreateFile(argv[i], GENERIC_READ, 0, NULL,
-            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    else for (int i = 0; i < nFiles; i++) {
+        tlsStats = stats ? &stats[i] : NULL;
+        long long t0 = StatStart();
+        IoFile hIn;
 
-        if (hIn == INVALID_HANDLE_VALUE) {
-            if (!dashS) ReportError(_T("File open error"), GetLastError(), TRUE);
+        if (!hIn.Open(names[i], IO_READ)) {
+            if (!dashS) IoReportError(_T("File open error"), IoLastError(), TRUE);
             continue;
         }
 
-        CatFile(hIn, hStdOut);
-        
-        DWORD err = GetLastError();
-        if (err != 0 && !dashS) {
-            ReportError(_T("Processing error"), err, TRUE);
+        if (!CatFile(hIn.Get(), hStdOut, TRUE)) {
+            IoError err = IoLastError();
+            if (err != 0 && !dashS) {
+                IoReportError(_T("Processing error"), err, TRUE);
+            }
         }
 
-        CloseHandle(hIn);
+        hIn.Close();
+        if (stats) stats[i].seconds = (StatClock() - t0) / 1e9;
+    }
+
+    /* Flow Step 3b: Line modes hold back a partly filled output buffer */
+    if (!FlushOut(hStdOut) && !dashS) {
+        IoReportError(_T("Processing error"), IoLastError(), TRUE);
+    }
+
+    /* Flow Step 4: Instrumentation report */
+    if (stats) {
+        tlsStats = NULL;
+        ReportStats(names, stats, nFiles, (StatClock() - tStart) / 1e9);
+        delete[] stats;
     }
     return 0;
 }
 
-static void CatFile(HANDLE hIn, HANDLE hOut) {
-    BYTE buffer[BUF_SIZE];
-    DWORD nRead, nWritten;
+static void PrintHist(FILE* f, const unsigned long long* hist) {
+    for (int k = 0; k < HIST_BUCKETS; k++) {
+        if (hist[k] == 0) continue;
+        fprintf(f, "    [%12lld, %12lld) ns  %llu\n", 1LL << k, 1LL << (k + 1), hist[k]);
+    }
+}
+
+static void PrintJsonHist(FILE* f, const unsigned long long* hist) {
+    int k = HIST_BUCKETS;
+    while (k > 0 && hist[k - 1] == 0) k--;      /* trailing zero buckets add nothing */
+    fprintf(f, "[");
+    for (int j = 0; j < k; j++) fprintf(f, "%s%llu", j ? "," : "", hist[j]);
+    fprintf(f, "]");
+}
+
+static void PrintJsonRecord(FILE* f, const CatStats* st) {
+    fprintf(f, "\"bytes\":%llu,\"reads\":%llu,\"writes\":%llu,\"short_writes\":%llu,"
+        "\"kernel_copies\":%llu,\"seconds\":%.6f,\"mb_per_s\":%.1f,\"read_hist_log2_ns\":",
+        st->bytes, st->reads, st->writes, st->shortWrites, st->kernelCopies, st->seconds,
+        st->seconds > 0 ? st->bytes / 1048576.0 / st->seconds : 0.0);
+    PrintJsonHist(f, st->readHist);
+    fprintf(f, ",\"write_hist_log2_ns\":");
+    PrintJsonHist(f, st->writeHist);
+}
+
+/* Per-file rows plus a total. In pipelined mode a packed buffer's write is
+ * charged to the last file it holds bytes from, and a file's time is the
+ * time spent reading it - its writes overlap with reading the next files -
+ * so per-file times there do not add up to the wall time. */
+static void ReportStats(TCHAR* names[], CatStats* stats, int n, double wall) {
+    CatStats total = CatStats();
+    for (int i = 0; i < n; i++) {
+        total.bytes += stats[i].bytes;
+        total.reads += stats[i].reads;
+        total.writes += stats[i].writes;
+        total.shortWrites += stats[i].shortWrites;
+        total.kernelCopies += stats[i].kernelCopies;
+        for (int k = 0; k < HIST_BUCKETS; k++) {
+            total.readHist[k] += stats[i].readHist[k];
+            total.writeHist[k] += stats[i].writeHist[k];
+        }
+    }
+    total.seconds = wall;
+
+    if (statsPath == NULL) {
+        _ftprintf(stderr, _T("%-32s %14s %9s %9s %7s %7s %10s %10s\n"),
+            _T("file"), _T("bytes"), _T("reads"), _T("writes"), _T("short"), _T("kcopy"), _T("seconds"), _T("MB/s"));
+        for (int i = 0; i <= n; i++) {
+            const CatStats* st = i < n ? &stats[i] : &total;
+            _ftprintf(stderr, _T("%-32s %14llu %9llu %9llu %7llu %7llu %10.4f %10.1f\n"),
+                i < n ? names[i] : _T("total"), st->bytes, st->reads, st->writes,
+                st->shortWrites, st->kernelCopies, st->seconds,
+                st->seconds > 0 ? st->bytes / 1048576.0 / st->seconds : 0.0);
+        }
+        fprintf(stderr, "  read latency:\n");
+        PrintHist(stderr, total.readHist);
+        fprintf(stderr, "  write latency:\n");
+        PrintHist(stderr, total.writeHist);
+        return;
+    }
+
+    FILE* f = _tfopen(statsPath, _T("w"));
+    if (f == NULL) {
+        IoReportError(_T("Cannot write stats file"), IoLastError(), TRUE);
+        return;
+    }
+    fprintf(f, "{\"files\":[");
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "%s\n{\"name\":\"", i ? "," : "");
+        for (const TCHAR* c = names[i]; *c; c++) {
+            if (*c == '"' || *c == '\\') fputc('\\', f);
+            fputc((*c >= 0x20 && *c < 0x7f) ? (char)*c : '?', f);
+        }
+        fprintf(f, "\",");
+        PrintJsonRecord(f, &stats[i]);
+        fprintf(f, "}");
+    }
+    fprintf(f, "],\n\"total\":{");
+    PrintJsonRecord(f, &total);
+    fprintf(f, "}}\n");
+    fclose(f);
+}
+
+/* Pipelined multi-file copy.
+ * A reader thread opens and reads the upcoming files into pooled buffers
+ * while the calling thread drains them to hOut, so open/read latency of file
+ * i+1 hides behind the write of file i. There is one producer and one
+ * consumer, so items - and the error messages they carry - come out in
+ * argument order. At most queueDepth items are queued, which bounds memory
+ * to about (queueDepth + 2) buffers. Large regular files are handed
+ * over as an open handle so the writer can still use CatFile's fast path. */
+struct CatItem {
+    enum Kind { DATA, FAILED, HANDOFF } kind;
+    BYTE* buf;                  /* DATA: filled buffer, returned to the pool by the writer */
+    DWORD len;                  /* DATA: valid bytes in buf */
+    HANDLE hIn;                 /* HANDOFF: open file for the writer to copy and close */
+    LPCTSTR msg;                /* FAILED: message for IoReportError */
+    IoError err;                /* FAILED: error code */
+    int file;                   /* index of the (last) file the item belongs to, for --stats */
+};
+
+class CatQueue {
+public:
+    CatQueue(size_t depth, size_t bufSize) : depth(depth), bufSize(bufSize), closed(false) {}
+
+    void Push(const CatItem& item) {
+        std::unique_lock<std::mutex> lock(mtx);
+        notFull.wait(lock, [this] { return items.size() < depth; });
+        items.push_back(item);
+        notEmpty.notify_one();
+    }
+
+    BOOL Pop(CatItem* item) {
+        std::unique_lock<std::mutex> lock(mtx);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return FALSE;
+        *item = items.front();
+        items.pop_front();
+        notFull.notify_one();
+        return TRUE;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        notEmpty.notify_one();
+    }
+
+    BYTE* GetBuffer() { return ioPool.Get(bufSize); }
+    void PutBuffer(BYTE* b) { ioPool.Put(b); }
+    DWORD BufferSize() const { return (DWORD)bufSize; }
+
+private:
+    size_t depth;
+    size_t bufSize;
+    bool closed;
+    std::deque<CatItem> items;
+    std::mutex mtx;
+    std::condition_variable notFull, notEmpty;
+};
+
+/* Small files are packed back to back into the same buffer, so a run of
+ * tiny files costs one queue hand-off and one write instead of one each.
+ * A partly filled buffer is flushed before any FAILED/HANDOFF item so the
+ * order of bytes and messages still follows the argument list. */
+static void ReadAhead(TCHAR* files[], int nFiles, CatQueue* q, CatStats* stats) {
+    BYTE* b = q->GetBuffer();
+    DWORD fill = 0, size = q->BufferSize();
+    int owner = 0;              /* last file with bytes in b */
+
+    for (int i = 0; i < nFiles; i++) {
+        CatItem item = { CatItem::FAILED, NULL, 0, INVALID_HANDLE_VALUE, NULL, 0, i };
+        tlsStats = stats ? &stats[i] : NULL;
+        long long t0 = StatStart();
+        IoFile hIn;
+
+        if (!hIn.Open(files[i], IO_READ)) {
+            item.msg = _T("File open error");
+            item.err = IoLastError();
+        }
+        else if (PreferHandoff(hIn.Get())) {
+            item.kind = CatItem::HANDOFF;
+            item.hIn = hIn.Release();
+        }
+        else {
+            BOOL readOK;
+            for (;;) {
+                DWORD n;
+                readOK = ReadChunk(hIn.Get(), b + fill, size - fill, &n);
+                if (!readOK) {
+                    item.msg = _T("Processing error");
+                    item.err = IoLastError();
+                    break;
+                }
+                if (n == 0) break;
+                fill += n;
+                owner = i;
+                if (fill == size) {
+                    CatItem data = { CatItem::DATA, b, fill, INVALID_HANDLE_VALUE, NULL, 0, owner };
+                    q->Push(data);
+                    b = q->GetBuffer();
+                    fill = 0;
+                }
+            }
+            hIn.Close();
+            if (stats) stats[i].seconds = (StatClock() - t0) / 1e9;
+            if (readOK) continue;
+        }
+
+        if (fill > 0) {
+            CatItem data = { CatItem::DATA, b, fill, INVALID_HANDLE_VALUE, NULL, 0, owner };
+            q->Push(data);
+            b = q->GetBuffer();
+            fill = 0;
+        }
+        q->Push(item);
+    }
 
-    while (ReadFile(hIn, buffer, BUF_SIZE, &nRead, NULL) && nRead > 0) {
-        if (!WriteFile(hOut, buffer, nRead, &nWritten, NULL) || nWritten != nRead) {
+    if (fill > 0) {
+        CatItem data = { CatItem::DATA, b, fill, INVALID_HANDLE_VALUE, NULL, 0, owner };
+        q->Push(data);
+    }
+    else {
+        q->PutBuffer(b);
+    }
+    q->Close();
+}
+
+static void CatPipelined(TCHAR* files[], int nFiles, HANDLE hOut, BOOL dashS, CatStats* stats) {
+    CatQueue q((size_t)queueDepth, IoBufSize(INVALID_HANDLE_VALUE, hOut, bufOverride));
+    std::thread reader(ReadAhead, files, nFiles, &q, stats);
+    CatItem item;
+
+    while (q.Pop(&item)) {
+        tlsStats = stats ? &stats[item.file] : NULL;
+        long long t0 = StatStart();
+        switch (item.kind) {
+        case CatItem::DATA:
+            if (!WriteOut(hOut, item.buf, item.len) && !dashS) {
+                IoReportError(_T("Processing error"), IoLastError(), TRUE);
+            }
+            q.PutBuffer(item.buf);
+            break;
+        case CatItem::FAILED:
+            if (!dashS) IoReportError(item.msg, item.err, TRUE);
+            break;
+        case CatItem::HANDOFF: {
+            IoFile hIn(item.hIn);
+            if (!CatFile(hIn.Get(), hOut, TRUE)) {
+                IoError err = IoLastError();
+                if (err != 0 && !dashS) IoReportError(_T("Processing error"), err, TRUE);
+            }
+            hIn.Close();
+            if (stats) stats[item.file].seconds += (StatClock() - t0) / 1e9;
             break;
         }
+        }
+    }
+    reader.join();
+}
+
+/* Copy strategies are tried fastest first; each one that cannot handle the
+ * handle pair leaves the file offset where the next one should resume.
+ * Only files opened by name are mapped - stdin stays on the read loop.
+ * With --direct only the read loop is used - kernel copies and mappings
+ * both go through the page cache - on O_DIRECT handles where the
+ * filesystem allows it, with drop-behind eviction where it does not.
+ * Line modes rewrite the bytes, so they also keep to the read loop, and
+ * their output is never O_DIRECT: CatLines writes from an unaligned fill. */
+static BOOL CatFile(HANDLE hIn, HANDLE hOut, BOOL named) {
+    BYTE* buffer;
+    DWORD nRead, size;
+    BOOL ok = FALSE, directOut = FALSE;
+    unsigned long long inPos = 0, outPos = 0;
+    IoDropState dropIn, dropOut;
+
+    if (directIO) {
+        IoDirectEnable(hIn);
+        directOut = lineMode ? FALSE : IoDirectEnable(hOut);
+        dropIn = IoDropState(inPos = IoTell(hIn));
+        dropOut = IoDropState(outPos = IoTell(hOut));
+    }
+    else if (!lineMode) {
+        if (copyMode == COPY_AUTO && KernelCopy(hIn, hOut)) return TRUE;
+
+        if (named && copyMode == COPY_MMAP) {
+            int r = MapCopy(hIn, hOut);
+            if (r != 0) return r > 0;
+        }
+    }
+
+    size = (DWORD)IoBufSize(hIn, hOut, bufOverride == 0 && directIO ? IODIRECT_BUF : bufOverride);
+    buffer = ioPool.Get(size);
+    if (buffer == NULL) return FALSE;
+
+    while (ReadChunk(hIn, buffer, size, &nRead)) {
+        if (nRead == 0) {
+            ok = TRUE;
+            break;
+        }
+        if (!WriteOut(hOut, buffer, nRead)) {
+            break;
+        }
+        if (directIO) {
+            IoDropBehind(hIn, &dropIn, inPos += nRead, false, false);
+            if (!lineMode) IoDropBehind(hOut, &dropOut, outPos += nRead, true, false);
+        }
+    }
+    if (directIO) {
+        IoDropBehind(hIn, &dropIn, inPos, false, true);
+        if (!lineMode) IoDropBehind(hOut, &dropOut, outPos, true, true);
+        if (directOut) IoDirectDisable(hOut);   /* stdout's open file may outlive us */
+    }
+    ioPool.Put(buffer);
+    return ok;
+}
+
+/* One read / the whole buffer out, with --stats probes. The I/O itself is
+ * iofile.h's, so both platforms share these; only the fast paths below differ. */
+static BOOL ReadChunk(HANDLE hIn, BYTE* buf, DWORD size, DWORD* nRead) {
+    size_t got;
+    long long t0 = StatStart();
+    BOOL ok = IoRead(hIn, buf, size, &got);
+    StatRead(t0);
+    *nRead = (DWORD)got;
+    return ok;
+}
+
+static BOOL WriteAll(HANDLE hOut, const BYTE* buf, DWORD n) {
+    while (n > 0) {
+        size_t put;
+        long long t0 = StatStart();
+        BOOL ok = IoWriteSome(hOut, buf, n, &put);
+        StatWrite(t0, n, put);
+        if (!ok || put == 0) return FALSE;
+        buf += put;
+        n -= (DWORD)put;
+    }
+    return TRUE;
+}
+
+/* Big regular files are cheaper to move with KernelCopy/MapCopy than through
+ * the queue; on Win32, which has no kernel copy, only --copy=mmap gains. With --direct every regular file goes to CatFile: the queue
+ * packs files at unaligned buffer offsets, which O_DIRECT cannot read into. */
+static BOOL PreferHandoff(HANDLE hIn) {
+    unsigned long long size;
+    if (!IoSize(hIn, &size)) return FALSE;
+    if (directIO) return TRUE;
+    if (lineMode) return FALSE;     /* every path is the read loop; packing saves calls */
+#ifdef _WIN32
+    if (copyMode != COPY_MMAP) return FALSE;
+#endif
+    return copyMode != COPY_READ && size >= HANDOFF_MIN;
+}
+
+/* Line modes. The stream is scanned in bulk, not byte by byte: without -v
+ * the only byte that matters is '\n', found with memchr; with -v the SIMD
+ * scanners below stop at '\n' or at the first byte that needs escaping,
+ * whichever comes first, and everything in between is copied as one run.
+ * So a line costs one scan and one or two memcpys into the output buffer,
+ * plus the number prefix, which comes from an ASCII counter incremented in
+ * place rather than a printf. All state (line number, at-line-start, the
+ * current run of empty lines) lives in one CatLines that sees the output of
+ * every file in order, so numbering and squeezing carry across reads and
+ * across files - a file without a final newline continues its last line
+ * into the next file, as GNU cat does. Only the writing thread uses it. */
+typedef const BYTE* (*ScanFn)(const BYTE* p, const BYTE* end);
+
+static inline bool NeedsEscape(BYTE c) {
+    return (c < 0x20 && c != '\t') || c >= 0x7f;        /* '\n' included: the scan stops there too */
+}
+
+static const BYTE* ScanScalar(const BYTE* p, const BYTE* end) {
+    while (p < end && !NeedsEscape(*p)) p++;
+    return p;
+}
+
+#ifdef XFORM_X86
+static inline int LowBit(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, mask);
+    return (int)i;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/* Signed compares: v < 0x20 is true for 0x00-0x1F and for 0x80-0xFF (negative
+ * as int8), which with == 0x7F and minus '\t' is exactly NeedsEscape. */
+XFORM_TARGET("sse2")
+static const BYTE* ScanSSE2(const BYTE* p, const BYTE* end) {
+    const __m128i space = _mm_set1_epi8(0x20), del = _mm_set1_epi8(0x7f), tab = _mm_set1_epi8('\t');
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i m = _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del));
+        m = _mm_andnot_si128(_mm_cmpeq_epi8(v, tab), m);
+        unsigned int bits = (unsigned int)_mm_movemask_epi8(m);
+        if (bits) return p + LowBit(bits);
+    }
+    return ScanScalar(p, end);
+}
+
+XFORM_TARGET("avx2")
+static const BYTE* ScanAVX2(const BYTE* p, const BYTE* end) {
+    const __m256i space = _mm256_set1_epi8(0x20), del = _mm256_set1_epi8(0x7f), tab = _mm256_set1_epi8('\t');
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        __m256i m = _mm256_or_si256(_mm256_cmpgt_epi8(space, v), _mm256_cmpeq_epi8(v, del));
+        m = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), m);
+        unsigned int bits = (unsigned int)_mm256_movemask_epi8(m);
+        if (bits) return p + LowBit(bits);
+    }
+    return ScanSSE2(p, end);
+}
+#endif
+
+static ScanFn PickScan() {
+#ifdef XFORM_X86
+    XformIsa isa = XformDetect();
+    if (isa >= XFORM_AVX2) return ScanAVX2;
+    if (isa >= XFORM_SSE2) return ScanSSE2;
+#endif
+    return ScanScalar;
+}
+
+class CatLines {
+public:
+    CatLines() : out(NULL), fill(0), size(0), ndig(1), atStart(true), blankRun(0), scan(NULL) {
+        memset(digits, '0', sizeof(digits));
+    }
+
+    BOOL Feed(HANDLE hOut, const BYTE* p, DWORD n) {
+        const BYTE* end = p + n;
+        BOOL number = numberLines || numberNonBlank;
+        if (showNonPrinting && scan == NULL) scan = PickScan();
+
+        while (p < end) {
+            if (atStart) {
+                if (*p == '\n') {
+                    p++;
+                    if (++blankRun > 1 && squeezeBlank) continue;
+                    if (numberLines && !numberNonBlank && !PutNumber(hOut)) return FALSE;
+                    if (!Put(hOut, (const BYTE*)"\n", 1)) return FALSE;
+                    continue;
+                }
+                blankRun = 0;
+                atStart = false;
+                if (number && !PutNumber(hOut)) return FALSE;
+            }
+            const BYTE* q;
+            if (showNonPrinting) q = scan(p, end);
+            else {
+                q = (const BYTE*)memchr(p, '\n', end - p);
+                if (q == NULL) q = end;
+            }
+            if (!Put(hOut, p, q - p)) return FALSE;
+            if (q == end) break;
+            if (*q == '\n') {
+                if (!Put(hOut, q, 1)) return FALSE;
+                atStart = true;
+            }
+            else if (!PutEscaped(hOut, *q)) return FALSE;
+            p = q + 1;
+        }
+        return TRUE;
+    }
+
+    BOOL Flush(HANDLE hOut) {
+        BOOL ok = fill == 0 || WriteAll(hOut, out, (DWORD)fill);
+        fill = 0;
+        return ok;
+    }
+
+private:
+    BOOL Put(HANDLE hOut, const BYTE* p, size_t n) {
+        if (out == NULL) {
+            size = IoBufSize(INVALID_HANDLE_VALUE, hOut, bufOverride);
+            out = ioPool.Get(size);
+            if (out == NULL) return FALSE;
+        }
+        if (n > size - fill) {
+            if (!Flush(hOut)) return FALSE;
+            if (n >= size) return WriteAll(hOut, p, (DWORD)n);   /* a long line: skip the copy */
+        }
+        memcpy(out + fill, p, n);
+        fill += n;
+        return TRUE;
+    }
+
+    /* "%6llu\t" from the counter: bump the last digit, carry leftwards. */
+    BOOL PutNumber(HANDLE hOut) {
+        const int top = (int)sizeof(digits) - 1;
+        int i = top;
+        while (i > top - ndig && digits[i] == '9') digits[i--] = '0';
+        if (i == top - ndig) ndig++;
+        digits[i]++;
+
+        BYTE tmp[sizeof(digits) + 8];
+        int pad = ndig < 6 ? 6 - ndig : 0;
+        memset(tmp, ' ', pad);
+        memcpy(tmp + pad, digits + sizeof(digits) - ndig, ndig);
+        tmp[pad + ndig] = '\t';
+        return Put(hOut, tmp, pad + ndig + 1);
+    }
+
+    /* cat -v notation: M- for the high bit, then ^X for controls, ^? for DEL. */
+    BOOL PutEscaped(HANDLE hOut, BYTE c) {
+        BYTE tmp[4];
+        int k = 0;
+        if (c >= 0x80) {
+            tmp[k++] = 'M';
+            tmp[k++] = '-';
+            c -= 0x80;
+        }
+        if (c < 0x20) {
+            tmp[k++] = '^';
+            tmp[k++] = (BYTE)(c + '@');
+        }
+        else if (c == 0x7f) {
+            tmp[k++] = '^';
+            tmp[k++] = '?';
+        }
+        else tmp[k++] = c;
+        return Put(hOut, tmp, k);
+    }
+
+    BYTE* out;              /* pooled output buffer, allocated on first use */
+    size_t fill, size;
+    char digits[24];        /* line number in ASCII, right-aligned; ndig significant */
+    int ndig;
+    bool atStart;           /* next byte begins a line */
+    unsigned int blankRun;  /* empty lines in a row so far, for --squeeze-blank */
+    ScanFn scan;
+};
+
+static CatLines catLines;
+
+/* Every write of file data goes through here, so the line modes see all of it. */
+static BOOL WriteOut(HANDLE hOut, const BYTE* buf, DWORD n) {
+    if (lineMode) return catLines.Feed(hOut, buf, n);
+    return WriteAll(hOut, buf, n);
+}
+
+static BOOL FlushOut(HANDLE hOut) {
+    return lineMode ? catLines.Flush(hOut) : TRUE;
+}
+
+#ifdef _WIN32
+/* No kernel-side file-to-handle copy on Win32; MapCopy is the fast path. */
+static int KernelCopy(HANDLE hIn, HANDLE hOut) {
+    (void)hIn; (void)hOut;
+    return 0;
+}
+
+/* Write the input straight out of a read-only view, MMAP_WINDOW bytes at a
+ * time, starting at the current file offset. Returns 1 when done, -1 when a
+ * write failed, 0 when the caller should carry on with the read loop from
+ * the (restored) file offset - not a disk file, empty, or a view could
+ * not be mapped. */
+static int MapCopy(HANDLE hIn, HANDLE hOut) {
+    LARGE_INTEGER size, pos, zero;
+    SYSTEM_INFO si;
+    HANDLE hMap;
+
+    zero.QuadPart = 0;
+    if (GetFileType(hIn) != FILE_TYPE_DISK || !GetFileSizeEx(hIn, &size)
+        || size.QuadPart == 0
+        || !SetFilePointerEx(hIn, zero, &pos, FILE_CURRENT)) return 0;
+
+    hMap = CreateFileMapping(hIn, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMap == NULL) return 0;
+    GetSystemInfo(&si);
+
+    while (pos.QuadPart < size.QuadPart) {
+        LONGLONG base = pos.QuadPart - pos.QuadPart % si.dwAllocationGranularity;
+        LONGLONG len = size.QuadPart - base < MMAP_WINDOW ? size.QuadPart - base : MMAP_WINDOW;
+        BYTE* view = (BYTE*)MapViewOfFile(hMap, FILE_MAP_READ,
+            (DWORD)(base >> 32), (DWORD)base, (SIZE_T)len);
+        if (view == NULL) {
+            CloseHandle(hMap);
+            SetFilePointerEx(hIn, pos, NULL, FILE_BEGIN);
+            return 0;
+        }
+
+        BOOL ok = WriteAll(hOut, view + (pos.QuadPart - base), (DWORD)(base + len - pos.QuadPart));
+        DWORD err = GetLastError();
+        UnmapViewOfFile(view);
+        if (!ok) {
+            CloseHandle(hMap);
+            SetLastError(err);
+            return -1;
+        }
+        pos.QuadPart = base + len;
     }
+    CloseHandle(hMap);
+    SetFilePointerEx(hIn, pos, NULL, FILE_BEGIN);
+    return 1;
 }
 
-static void ReportError(LPCTSTR msg, DWORD errCode, BOOL showErrMsg) {
-    _ftprintf(stderr, _T("ERROR: %s"), msg);
+#else
+/* Largest count a single sendfile/copy_file_range/splice call will move on Linux. */
+#define KCOPY_CHUNK 0x7ffff000
+
+/* Kernel-side copy: the bytes never enter user space.
+ *   regular file -> regular file : copy_file_range (may share extents / offload)
+ *   regular file -> pipe/socket  : sendfile
+ *   pipe         -> anything     : splice
+ * Returns 1 when the input reached EOF, 0 when the caller should finish the
+ * job with the buffered loop. Both fd offsets are advanced by the kernel, so
+ * falling back part-way through is safe: the read loop resumes where the
+ * kernel stopped, and it is the one that reports any persistent error. */
+static int KernelCopy(HANDLE hIn, HANDLE hOut) {
+#ifdef __linux__
+    struct stat stIn, stOut;
+    if (fstat(hIn, &stIn) != 0 || fstat(hOut, &stOut) != 0) return 0;
+
+    for (;;) {
+        ssize_t n;
+        long long t0 = StatStart();
+        if (S_ISREG(stIn.st_mode) && S_ISREG(stOut.st_mode))
+            n = copy_file_range(hIn, NULL, hOut, NULL, KCOPY_CHUNK, 0);
+        else if (S_ISREG(stIn.st_mode))
+            n = sendfile(hOut, hIn, NULL, KCOPY_CHUNK);
+        else if (S_ISFIFO(stIn.st_mode))
+            n = splice(hIn, NULL, hOut, NULL, KCOPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        else
+            return 0;
 
-    if (showErrMsg) {
-        LPVOID errMsg;
-        FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER |
-            FORMAT_MESSAGE_FROM_SYSTEM,
-            NULL, errCode, 0,
-            (LPTSTR)&errMsg, 0, NULL);
+        StatKernelCopy(t0, n > 0 ? (size_t)n : 0);
+        if (n == 0) return 1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+    }
+#else
+    (void)hIn; (void)hOut;
+    return 0;
+#endif
+}
+
+/* Write the input straight out of a read-only mapping, MMAP_WINDOW bytes at
+ * a time, starting at the current file offset. MADV_SEQUENTIAL lets the
+ * kernel read ahead aggressively and drop pages behind us. Returns 1 when
+ * done, -1 when a write failed, 0 when the caller should carry on with the
+ * read loop from the (restored) file offset - not a regular file, or a
+ * window could not be mapped. As with any mmap reader, a file
+ * truncated underneath us raises SIGBUS. */
+static int MapCopy(HANDLE hIn, HANDLE hOut) {
+    struct stat st;
+    off_t pos;
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (fstat(hIn, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+    if ((pos = lseek(hIn, 0, SEEK_CUR)) < 0) return 0;
+
+    while (pos < st.st_size) {
+        off_t base = pos - pos % page;
+        size_t len = st.st_size - base < MMAP_WINDOW ? (size_t)(st.st_size - base) : MMAP_WINDOW;
+        BYTE* view = (BYTE*)mmap(NULL, len, PROT_READ, MAP_SHARED, hIn, base);
+        if (view == MAP_FAILED) {
+            lseek(hIn, pos, SEEK_SET);
+            return 0;
+        }
+        madvise(view, len, MADV_SEQUENTIAL);
 
-        _ftprintf(stderr, _T(" (%s)"), (LPTSTR)errMsg);
-        LocalFree(errMsg);
+        BOOL ok = WriteAll(hOut, view + (pos - base), (DWORD)(base + len - pos));
+        munmap(view, len);
+        if (!ok) return -1;
+        pos = base + (off_t)len;
     }
-    _ftprintf(stderr, _T("\n"));
+    lseek(hIn, pos, SEEK_SET);
+    return 1;
 }
+#endif
@@ -1,8 +1,13 @@
+#ifdef _WIN32
 #include <windows.h> // (1) Preprocessor directive instructs compiler
                      // to insert windows.h content. Expands to
                      // declarations, potentially inlining functions.
                      // May increase compile time, but avoids
                      // dynamic linking overhead for WinAPI calls.
+#else
+#include <unistd.h>   // (1a) POSIX build: syncfs / fdatasync for --durability=batch.
+#include <sys/mman.h> // (1b) In-place mode (44i..44n) maps the file.
+#endif
 
 #include <stdio.h>   // (2) Includes stdio.h. Compiler searches
                      // predefined paths for this header. Provides
@@ -10,45 +15,210 @@
                      // FILE* struct managed in user space before
                      // system calls for actual I/O operations.
 
+#include <string.h>  // (2a) strncmp for option parsing in main.
+#include <math.h>    // (2b) log() for --detect scoring (44t).
+
 #include <stdlib.h>  // (3) Includes stdlib.h.  Offers general
                      // utilities. `atoi` relies on locale settings
                      // for number parsing, which introduces
                      // potential platform-dependent behavior.
 
-#define BUF_SIZE 4096 // (4) Preprocessor macro substitution. Each
-                     // `BUF_SIZE` instance replaced by '4096'
-                     // *before* compilation. No runtime cost, but
-                     // debugging macro expansions can be harder.
-                     // Value is decimal, compiler converts to binary.
+#include "xform.h"   // (3a) Transform engine (Caesar, XOR, Vigenere, ROT13,
+                     //      Atbash) with vectorized kernels, see (30).
+#include "crc32c.h"  // (3c) In-pass checksums for --checksum / --verify (44s).
+
+#include <algorithm> // (3d) std::find over synced filesystems, --durability=batch (4s).
+#include <atomic>    // (3b) Parallel mode (44a..44h) and batch mode (44q):
+#include <condition_variable> // worker threads, per-worker chunk queues for
+#include <deque>     //      work stealing, admission limits, shared counters.
+#include <memory>    //      Streaming mode's buffer ring (44u).
+#include <mutex>
+#include <string>    //      Temp file name for --safe (44m).
+#include <thread>
+#include <vector>
+
+#include "iobuf.h"   // (4) Shared buffer policy (also used by cat.cpp).
+                     // Buffer size is no longer a 4096 compile-time
+                     // constant: IoBufSize asks both open handles
+                     // (fstat block size, pipe capacity) and takes
+                     // the larger, unless --bufsize overrides it.
+
+#include "iofile.h"  // (4a) Portable file I/O shared with cat.cpp and freespace.cpp:
+                     //      RAII IoFile handles, whole/positional reads and writes,
+                     //      sync, rename, IoReportError. On POSIX it also defines the
+                     //      WinAPI scalar types (BOOL, DWORD, HANDLE is an int fd) this
+                     //      file is written in, so there is no separate shim here.
+
+static size_t bufOverride = 0; // (4b) --bufsize=N from main; 0 = let IoBufSize decide.
+static unsigned nThreads = 1;  // (4d) --threads=N from main; 1 = serial cci_f, 0 = one per core.
+static BOOL inPlace = FALSE;   // (4e) --in-place, or input and output are the same file.
+static BOOL safeWrite = FALSE; // (4f) --safe: write a temp file and rename it over the target.
+static BOOL batchMode = FALSE; // (4g) --batch: failures are collected per entry, not printed.
+static thread_local const char* cciError = NULL; // (4h) Why the last call on this thread failed.
+static unsigned batchJobs = 8;                   // (4i) --jobs=N: batch worker threads.
+static unsigned batchMaxOpen = 64;               // (4j) --max-open=N: file handles open at once.
+static unsigned long long batchMaxBytes = 256ULL << 20; // (4k) --max-inflight=SIZE: input bytes in progress.
+static BOOL checksumMode = FALSE; // (4m) --checksum: write "<output>.crc32c" after each job.
+static BOOL verifyMode = FALSE;   // (4n) --verify: check each job against "<input>.crc32c".
+static BOOL directMode = FALSE;   // (4t) --direct: O_DIRECT copies, else drop-behind (iobuf.h), so
+                                  //      bulk jobs do not evict everyone else's page cache.
+static FILE* msgOut = stdout;     // (4u) Status messages; stderr when the output is "-" (44u),
+                                  //      so they cannot end up inside the stream.
+
+struct CciDigest { // (4l) CRC32C of everything read and written so far, and its length.
+    uint32_t crcIn, crcOut;
+    unsigned long long length;
+};
+static thread_local CciDigest* cciDigest = NULL; // (4l) Set by cci_run when checksums are on.
+static thread_local unsigned long long cciConsumed = 0; // (4v) Input bytes the last cci_f / cci_mt call on
+                                                        //      this thread read and wrote out; --safe checks it.
+
+// (4p) --durability: what "done" means for an output file.
+//        none     - leave writeback to the OS; fastest, lost on power failure.
+//        data     - fdatasync: file data (and size) on disk, other metadata lazily.
+//        periodic - start writeback of each completed WRITEBACK_CHUNK range
+//                   while writing (sync_file_range) and wait for the one before,
+//                   so dirty pages never pile up; fdatasync at the end finds
+//                   little left to do. Linux only; elsewhere same as data.
+//        full     - fsync / FlushFileBuffers after every file. The default,
+//                   and what cci_f always did.
+//        batch    - no per-file sync; once the whole run or batch has
+//                   finished, one syncfs() per filesystem the outputs are on
+//                   (Linux), or an fdatasync of each output elsewhere. Never
+//                   a global sync(): that would flush every other service's
+//                   filesystems too. Win32 has no unprivileged equivalent,
+//                   so there it is the same as full.
+//      Whatever the mode, --safe syncs its temp file before the rename.
+enum CciDurability { DUR_NONE, DUR_DATA, DUR_PERIODIC, DUR_FULL, DUR_BATCH };
+static const char* const durabilityNames[] = { "none", "data", "periodic", "full", "batch" };
+static int durability = DUR_FULL;
+#define WRITEBACK_CHUNK (8ULL << 20)
+
+// (4q) End-of-file sync for the current mode.
+static BOOL SyncOutput(HANDLE h) {
+    switch (durability) {
+    case DUR_NONE: return TRUE;
+    case DUR_DATA:
+    case DUR_PERIODIC: return IoSyncData(h);
+#ifndef _WIN32
+    case DUR_BATCH: return TRUE;
+#endif
+    default: return IoSync(h);
+    }
+}
+
+// (4r) Periodic mode: bytes [*synced, written) are complete. Once a whole
+//      WRITEBACK_CHUNK has built up, queue it for writeback and, if wait,
+//      wait for everything queued before it. Sequential writers wait;
+//      parallel workers (own chunk each) only queue, so they never block on
+//      each other's half-written ranges.
+static void Writeback(HANDLE h, unsigned long long* synced, unsigned long long written, BOOL wait) {
+#ifdef SYNC_FILE_RANGE_WRITE
+    if (durability != DUR_PERIODIC || written - *synced < WRITEBACK_CHUNK) return;
+    sync_file_range(h, (off_t)*synced, (off_t)(written - *synced), SYNC_FILE_RANGE_WRITE);
+    if (wait && *synced > 0)
+        sync_file_range(h, 0, (off_t)*synced,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    *synced = written;
+#else
+    (void)h; (void)synced; (void)written; (void)wait;
+#endif
+}
+
+// (4s) Batch mode's one sync, after the last job. cci_run notes each
+//      output it completed. On Linux each is only stat()ed, and the first
+//      one on each filesystem is opened read-only for that filesystem's
+//      syncfs; elsewhere each is reopened and synced.
+static std::mutex batchLock;
+static std::vector<std::string> batchOutputs;
+
+static void NoteBatchOutput(const std::string& path) {
+    if (durability != DUR_BATCH) return;
+    std::lock_guard<std::mutex> guard(batchLock);
+    batchOutputs.push_back(path);
+}
+
+static BOOL SyncBatch() {
+    BOOL ok = TRUE;
+#ifndef _WIN32
+#ifdef __linux__
+    std::vector<dev_t> synced;
+#endif
+    for (size_t i = 0; i < batchOutputs.size(); i++) {
+        const char* path = batchOutputs[i].c_str();
+        IoFile h;
+#ifdef __linux__
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            fprintf(msgOut, "Cannot find %s to flush it: %s\n", path, strerror(errno));
+            ok = FALSE;
+            continue;
+        }
+        if (std::find(synced.begin(), synced.end(), st.st_dev) != synced.end()) continue;
+        if (!h.Open(path, IO_READ)) {      // syncfs needs any fd on the filesystem, not write access
+            fprintf(msgOut, "Cannot reopen %s to flush it: %s\n", path, strerror(errno));
+            ok = FALSE;
+            continue;
+        }
+        synced.push_back(st.st_dev);
+        if (syncfs(h.Get()) != 0) {
+#else
+        if (!h.Open(path, IO_WRITE)) {
+            fprintf(msgOut, "Cannot reopen %s to flush it: %s\n", path, strerror(errno));
+            ok = FALSE;
+            continue;
+        }
+        if (!IoSyncData(h.Get())) {
+#endif
+            fprintf(msgOut, "Cannot flush output files (%s): %s\n", path, strerror(errno));
+            ok = FALSE;
+        }
+    }
+#endif
+    batchOutputs.clear();
+    return ok;
+}
+
+// (4o) xf.Apply plus the digest update, so checksums ride along with the
+//      transform while the data is still in cache: no second pass.
+static void ApplyDigest(const Xform& xf, const unsigned char* in, unsigned char* out, size_t n,
+                        unsigned long long pos, CciDigest* dg) {
+    if (dg != NULL) dg->crcIn = Crc32c(dg->crcIn, in, n);
+    xf.Apply(in, out, n, pos);
+    if (dg != NULL) {
+        dg->crcOut = Crc32c(dg->crcOut, out, n);
+        dg->length += n;
+    }
+}
 
-BOOL cci_f(LPCSTR fIn, LPCSTR fOut, DWORD shift) // (5) Function declaration. `BOOL` maps to `int`.
-                                                 //  `LPCSTR` likely becomes `const char*` under
-                                                 //  the hood – pointer passed by value. `DWORD`
-                                                 //  is unsigned 32-bit int, ABI-dependent size.
+static void CciFail(const char* msg) { // (4h) Every driver reports failure through here.
+    cciError = msg;
+    if (!batchMode) fprintf(msgOut, "%s\n", msg);
+}
+static IoBufPool ioPool;       // (4c) Page-aligned buffers, allocated on first use and
+                               //      reused by every later cci_f call in this process.
+
+BOOL cci_f(LPCSTR fIn, LPCSTR fOut, const Xform& xf) // (5) Function declaration. `BOOL` maps to `int`.
+                                                     //  `LPCSTR` likely becomes `const char*` under
+                                                     //  the hood – pointer passed by value. `xf` is
+                                                     //  the configured transform, passed by reference.
 
 { // (6) Start function scope. Stack frame allocation
   // begins when function is called. Registers are
   // saved according to calling convention (e.g., x86).
 
-    HANDLE hIn = INVALID_HANDLE_VALUE, hOut = INVALID_HANDLE_VALUE; // (7) `HANDLE` is opaque pointer type, likely void*.
-                                                                   // Initialized to macro, likely -1 or similar
-                                                                   // integer bit pattern. Compiler reserves stack
-                                                                   // space for two HANDLE variables – sizeof(void*) * 2.
+    IoFile hIn, hOut; // (7) RAII handles from iofile.h: a Win32 HANDLE or a POSIX fd
+                      // underneath. Each is closed by its destructor on every return
+                      // path below, so no early exit can leak one.
+
+    DWORD bufSize = 0;               // (9a) Bytes per IoRead, from IoBufSize.
 
-    unsigned char aBuffer[BUF_SIZE];  // (8) `unsigned char` is 1 byte. `aBuffer` is
-                                     // statically allocated array on stack, size is
-                                     // compile-time constant BUF_SIZE * 1 byte = 4KB.
-                                     // Stack pointer adjusted down by 4096 bytes.
+    size_t nIn = 0; // (10) Bytes returned by the last IoRead.
 
-    unsigned char ccBuffer[BUF_SIZE]; // (9) Another 4KB stack array. Total stack usage
-                                     // for buffers is 8KB within this function.
-                                     // Stack overflow possible if stack size is limited
-                                     // and BUF_SIZE is very large or nested calls occur.
+    unsigned long long pos = 0; // (10a) Stream offset of aBuffer[0], for keyed transforms.
+    unsigned long long synced = 0; // (10b) Output bytes already handed to writeback, see (4r).
 
-    DWORD nIn = 0, nOut = 0, iCopy = 0; // (10) Three DWORD (unsigned 32-bit int) variables.
-                                         //  Compiler allocates 3 * sizeof(DWORD) bytes
-                                         //  on the stack. Zero initialization happens
-                                         //  at function entry, potentially using XOR reg, reg.
+    cciConsumed = 0;
 
     BOOL WriteOK = FALSE; // (11) `BOOL` variable, likely `int`. Stack allocation
                           // of sizeof(int) bytes. Initialized to 0 (FALSE).
@@ -56,109 +226,1026 @@ BOOL cci_f(LPCSTR fIn, LPCSTR fOut, DWORD shift) // (5) Function declaration. `B
 
     // First verify input file exists and is readable (12) Comment - compiler ignores. No machine code gen.
 
-    if (GetFileAttributesA(fIn) == INVALID_FILE_ATTRIBUTES) { // (13) `GetFileAttributesA` is WinAPI call. Compiler
-        // `GetFileAttributesA(fIn)` (13.1):  Generates call instruction to address of
-        //  GetFileAttributesA (resolved at link/load time).
-        //  String `fIn` pointer passed as argument in register/stack.
-        // `== INVALID_FILE_ATTRIBUTES` (13.2):  Integer comparison. CPU compares return value
-        //  register against INVALID_FILE_ATTRIBUTES constant.
-        printf("Input file does not exist\n"); // (14) `printf` call. Format string likely placed in
+    if (!IoExists(fIn)) { // (13) `IoExists`: GetFileAttributesA on Win32, stat elsewhere.
+        CciFail("Input file does not exist"); // (14) `CciFail` call, see (4h). Message string likely placed in
         // .rodata section of executable. String pointer passed.
         return FALSE; // (15) Returns integer 0 (FALSE). Function exit sequence
         // restores saved registers, adjusts stack pointer up.
     } // (16) End of if block. Conditional jump instruction based on comparison.
 
-    hIn = CreateFileA(fIn, GENERIC_READ, FILE_SHARE_READ, NULL, // (17) `CreateFileA` WinAPI. Multiple arguments.
-                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL); // Arguments are pushed onto stack or registers
-                                                                   // according to calling convention (stdcall likely).
-        // `CreateFileA(...)` (17.1): System call overhead. Kernel mode transition.
-            // `fIn`: (17.1.1) Pointer to input filename string.
-            // `GENERIC_READ`: (17.1.2) Constant, likely inlined by compiler.
-            // `FILE_SHARE_READ`: (17.1.3) Constant, inlined.
-            // `NULL`: (17.1.4) Null pointer, represented as address 0.
-            // `OPEN_EXISTING`: (17.1.5) Constant, inlined.
-            // `FILE_ATTRIBUTE_NORMAL`: (17.1.6) Constant, inlined.
-            // `NULL`: (17.1.7) Null pointer.
-
-    if (hIn == INVALID_HANDLE_VALUE) { // (18) Handle validity check. Integer comparison.
-        printf("Cannot open input file\n"); // (19) `printf` for error message. String literal in .rodata.
+    if (!hIn.Open(fIn, IO_READ)) { // (17) Open existing, read-only, others may read too
+                                   // (CreateFileA with GENERIC_READ, FILE_SHARE_READ,
+                                   // OPEN_EXISTING; open(O_RDONLY) on POSIX).
+        CciFail("Cannot open input file"); // (19) `CciFail` for error message. String literal in .rodata.
         return FALSE; // (20) Return FALSE (0). Function exit sequence.
     } // (21) End if. Conditional jump.
 
-    hOut = CreateFileA(fOut, GENERIC_WRITE, 0, NULL, // (22) Another `CreateFileA` WinAPI call for output.
-                       CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL); // Similar argument passing as input file opening.
-        // `CreateFileA(...)` (22.1): System call, kernel transition. Overwrites existing file.
-            // `fOut`: (22.1.1) Output filename pointer.
-            // `GENERIC_WRITE`: (22.1.2) Constant.
-            // `0`: (22.1.3) Integer literal 0.
-            // `NULL`: (22.1.4) Null pointer.
-            // `CREATE_ALWAYS`: (22.1.5) Constant.
-            // `FILE_ATTRIBUTE_NORMAL`: (22.1.6) Constant.
-            // `NULL`: (22.1.7) Null pointer.
-
-    if (hOut == INVALID_HANDLE_VALUE) { // (23) Output handle validation. Integer comparison.
-        CloseHandle(hIn); // (24) `CloseHandle` WinAPI call. Argument hIn passed.
-        printf("Cannot create output file\n"); // (25) `printf` error message.
+    if (!hOut.Open(fOut, IO_CREATE)) { // (22) Create or truncate, write-only
+                                       // (CREATE_ALWAYS; O_CREAT | O_TRUNC).
+        CciFail("Cannot create output file"); // (25) `CciFail` error message. hIn closes itself (7).
         return FALSE; // (26) Return FALSE (0).
     } // (27) End if. Conditional jump.
 
+    bufSize = (DWORD)IoBufSize(hIn.Get(), hOut.Get(),    // (27a) One size for both buffers;
+        bufOverride == 0 && directMode ? IODIRECT_BUF : bufOverride); // 1 MB by default with --direct.
+    IoBuf aBuffer(ioPool, bufSize);  // (8) Input buffer, leased from ioPool now that both
+                                     // handles are open and their preferred size is
+                                     // known. Page-aligned heap memory, so a large size
+                                     // costs no stack and is not re-allocated per call.
+    IoBuf ccBuffer(ioPool, bufSize); // (9) Output buffer, same size and origin. Both go
+                                     // back to the pool when the leases go out of scope.
+    if (!aBuffer.Valid() || !ccBuffer.Valid()) {         // (27c) Out of memory.
+        CciFail("Cannot allocate buffers");
+        return FALSE;
+    }
+
+    IoDropState dropIn, dropOut;   // (27d) --direct, see (4t). Aligned buffers from the pool;
+    if (directMode) {              //       only the unaligned last write goes buffered.
+        IoDirectEnable(hIn.Get());
+        IoDirectEnable(hOut.Get());
+    }
+
     // Process file (28) Comment. Ignored by compiler.
 
-    while (ReadFile(hIn, aBuffer, BUF_SIZE, &nIn, NULL) && nIn > 0) { // (29) `ReadFile` WinAPI in loop condition.
-        // `ReadFile(hIn, aBuffer, BUF_SIZE, &nIn, NULL)` (29.1): System call for reading file data.
-            // `hIn`: (29.1.1) Input file handle.
-            // `aBuffer`: (29.1.2) Pointer to buffer for read data.
-            // `BUF_SIZE`: (29.1.3) Number of bytes to read (4096).
-            // `&nIn`: (29.1.4) Pointer to DWORD to store bytes read.
-            // `NULL`: (29.1.5) Null pointer for overlapped I/O.
-        // `&& nIn > 0` (29.2): Logical AND and integer comparison. Loop continues
-        // as long as `ReadFile` returns TRUE (non-zero) and nIn is positive.
-
-        for (iCopy = 0; iCopy < nIn; iCopy++) { // (30) `for` loop. `iCopy` incremented and compared.
-            // `iCopy = 0; iCopy < nIn; iCopy++` (30.1): Loop initialization, condition, increment.
-            // Compiler may unroll loop for small fixed `nIn` (unlikely here).
-
-            ccBuffer[iCopy] = (BYTE)((aBuffer[iCopy] + shift) % 256); // (31) Byte-wise Caesar cipher.
-                // `aBuffer[iCopy]` (31.1): Array access. Address calculation: base + iCopy * sizeof(char).
-                // `+ shift` (31.2): Integer addition. CPU add instruction.
-                // `% 256` (31.3): Modulo operation. Compiler may optimize using bitwise AND if 256 is power of 2.
-                // `(BYTE)(...)` (31.4): Explicit type cast. Truncates result to 8 bits.
-                // `ccBuffer[iCopy] = ...` (31.5): Array assignment. Memory write operation.
-
-        } // (32) End for loop. Jump back to loop condition check.
-
-        if (!WriteFile(hOut, ccBuffer, nIn, &nOut, NULL) || nOut != nIn) { // (33) `WriteFile` WinAPI to write ciphered data.
-            // `WriteFile(hOut, ccBuffer, nIn, &nOut, NULL)` (33.1): System call for writing to file.
-                // `hOut`: (33.1.1) Output file handle.
-                // `ccBuffer`: (33.1.2) Pointer to ciphered data buffer.
-                // `nIn`: (33.1.3) Number of bytes to write.
-                // `&nOut`: (33.1.4) Pointer to DWORD to store bytes written.
-                // `NULL`: (33.1.5) Null pointer.
-            // `!WriteFile(...)` (33.2): Logical NOT of return value. Check for write failure.
-            // `|| nOut != nIn` (33.3): Logical OR. Check for partial write. Short-circuiting behavior.
-
-            printf("Write error occurred\n"); // (34) `printf` error message.
+    WriteOK = TRUE; // (28a) An empty input is a successful (empty) copy, not a failure.
+
+    for (;;) { // (29) One `IoRead` per pass.
+        // (29.1) One ReadFile / read() of up to bufSize bytes at the current
+        //        offset, retried on EINTR. Returns FALSE only on a real error.
+        BOOL ReadOK = IoRead(hIn.Get(), aBuffer.Get(), bufSize, &nIn);
+        if (!ReadOK) { // (29.2) A read error (EISDIR, EIO, ...) is a failure, never end of file.
+            CciFail("Read error occurred");
+            WriteOK = FALSE;
+            break;
+        }
+        if (nIn == 0) break; // (29.3) Only a successful zero-byte read is a clean end of file.
+
+        ApplyDigest(xf, aBuffer.Get(), ccBuffer.Get(), nIn, pos, cciDigest); // (30) Byte-wise transform over the whole chunk.
+            // (30.1) Caesar gives the same result as `(BYTE)((aBuffer[i] + shift) % 256)`
+            //        for every i: only `shift & 0xFF` can reach the low byte, so the
+            //        kernel adds that one byte with 8-bit wraparound, for any `shift`.
+            // (30.2) Kernel chosen once from CPUID: AVX-512 (64 B per op),
+            //        AVX2 (32 B), SSE2 (16 B) or scalar. See xform.h.
+            // (30.3) `pos` lines Vigenere key bytes up with stream offsets.
+            // (30.4) With --checksum/--verify, CRC32C of both buffers is updated here too.
+        pos += nIn;
+
+        if (!IoWrite(hOut.Get(), ccBuffer.Get(), nIn)) { // (33) `IoWrite` writes all nIn bytes or fails.
+            // (33.1) Loops over WriteFile / write() until the whole chunk is out,
+            //        so a short write is not mistaken for success.
+
+            CciFail("Write error occurred"); // (34) `CciFail` error message.
+            WriteOK = FALSE; // (34a) Earlier chunks may have succeeded; the file as a whole did not.
             break; // (35) `break` statement. Unconditional jump out of `while` loop.
         } // (36) End if. Conditional jump.
 
         WriteOK = TRUE; // (37) Set `WriteOK` to TRUE (1). Simple assignment.
-    } // (38) End while loop. Jump back to `ReadFile` call if condition met.
+        Writeback(hOut.Get(), &synced, pos, TRUE); // (37a) --durability=periodic only.
+        if (directMode) { // (37b) Evict what O_DIRECT could not keep out of the cache.
+            IoDropBehind(hIn.Get(), &dropIn, pos, false, false);
+            IoDropBehind(hOut.Get(), &dropOut, pos, true, false);
+        }
+    } // (38) End loop. Jump back to `IoRead` call.
 
     // Cleanup (39) Comment. Ignored.
 
-    FlushFileBuffers(hOut); // (40) `FlushFileBuffers` WinAPI call. Forces OS to write
-        // `FlushFileBuffers(hOut)` (40.1): System call to synchronize file buffers.
-        // data to disk. Reduces data loss risk on crashes.
+    cciConsumed = pos; // (39b) Every byte read so far was also written, see (4v).
+
+    if (directMode) { // (39a) Last partial step; waits for the output's writeback.
+        IoDropBehind(hIn.Get(), &dropIn, pos, false, true);
+        IoDropBehind(hOut.Get(), &dropOut, pos, true, true);
+    }
 
-    CloseHandle(hIn); // (41) `CloseHandle` WinAPI call. Releases input file handle.
-        // `CloseHandle(hIn)` (41.1): System call to release kernel object.
+    if (WriteOK && !SyncOutput(hOut.Get())) { // (40) `SyncOutput`: IoSync, IoSyncData or
+        CciFail("Cannot flush output file");  // nothing, per --durability (4p).
+        WriteOK = FALSE;
+    }
+        // (40.1) A failed flush means the data may not be on disk: the call fails.
 
-    CloseHandle(hOut); // (42) `CloseHandle` WinAPI call. Releases output file handle.
-        // `CloseHandle(hOut)` (42.1): System call to release kernel object.
+    if (!hOut.Close() && WriteOK) { // (42) Close now rather than in the destructor, so a
+        CciFail("Write error occurred"); // deferred write error (NFS, quota) is still seen.
+        WriteOK = FALSE;
+    }
+        // (41) hIn and the two buffer leases are released on return.
 
     return WriteOK; // (43) Return `WriteOK` value (TRUE or FALSE). Function exit.
 } // (44) End function scope. Stack frame deallocation. Stack pointer adjusted up.
 
+// (44u) Streaming mode: "-" for the input and/or the output means stdin /
+//       stdout, so the cipher can sit inside a pipeline
+//       (tar c dir | cipher - - 77 | ssh host 'cat > dir.tar.cci') with no
+//       temp file. Nothing here needs the length or a second pass, so
+//       pipes, ttys and sockets all work. The IoExists check of (13) is
+//       skipped because a pipe has no name to look up.
+//
+//       Three stages, one thread each, pass STREAM_RING reusable ioPool
+//       buffers round a ring:
+//           reader (calling thread) -> transform (in place) -> writer
+//       A stage waits only when the slot it needs is not ready yet: the
+//       reader waits when all slots are still queued ahead of the writer,
+//       and the other two wait for the stage before them. So while the
+//       writer is blocked on a full downstream pipe, the reader keeps
+//       draining upstream, up to STREAM_RING buffers ahead, and the
+//       transform runs on both sides of the I/O instead of between it.
+//       Each read is passed on as soon as it returns, even a short one, so
+//       an interactive stream is never held back to fill a buffer.
+#define STREAM_RING 8
+
+struct StreamSlot {
+    unsigned char* buf;
+    size_t len;
+    unsigned long long pos;   // stream offset of buf[0], for keyed transforms
+};
+
+// (44v) Counters of slots read, transformed and written so far; slot i
+//       lives in slots[i % size]. One lock and one condition variable for
+//       all three stages: every hand-off is a whole buffer, so this costs
+//       one lock per buffer per stage.
+class StreamRing {
+public:
+    explicit StreamRing(size_t n) : slots(n), nRead(0), nXformed(0), nWritten(0), eof(false), error(NULL) {}
+
+    StreamSlot& Slot(unsigned long long i) { return slots[(size_t)(i % slots.size())]; }
+
+    // Reader: the next free slot, or NULL once a stage has failed.
+    StreamSlot* Free() {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this] { return nRead - nWritten < slots.size() || error != NULL; });
+        return error != NULL ? NULL : &Slot(nRead);
+    }
+    void Filled(BOOL end) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (end) eof = true;
+        else nRead++;
+        cv.notify_all();
+    }
+
+    // Transform: slot i once read, NULL at end of stream or on failure.
+    StreamSlot* Readable(unsigned long long i) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this, i] { return i < nRead || eof || error != NULL; });
+        return i < nRead && error == NULL ? &Slot(i) : NULL;
+    }
+    void Transformed() {
+        std::lock_guard<std::mutex> lock(mtx);
+        nXformed++;
+        cv.notify_all();
+    }
+
+    // Writer: slot i once transformed, NULL at end of stream or on failure.
+    StreamSlot* Writable(unsigned long long i) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this, i] { return i < nXformed || (eof && nXformed == nRead) || error != NULL; });
+        return i < nXformed && error == NULL ? &Slot(i) : NULL;
+    }
+    void Written() {
+        std::lock_guard<std::mutex> lock(mtx);
+        nWritten++;
+        cv.notify_all();
+    }
+
+    void Fail(const char* msg) {   // First failure wins; every stage then stops.
+        std::lock_guard<std::mutex> lock(mtx);
+        if (error == NULL) error = msg;
+        cv.notify_all();
+    }
+    const char* Error() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return error;
+    }
+
+private:
+    std::vector<StreamSlot> slots;
+    unsigned long long nRead, nXformed, nWritten;
+    bool eof;
+    const char* error;
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+// (44w) A named side is opened as in cci_f and synced/closed the same way.
+//       "-" is used as is, never synced or closed: syncing a pipe is an
+//       error, and stdout belongs to whoever started us. --threads and
+//       --direct do not apply: the stages are the parallelism, and pipes
+//       cannot bypass the page cache.
+BOOL cci_stream(LPCSTR fIn, LPCSTR fOut, const Xform& xf) {
+    IoFile fileIn, fileOut;
+    BOOL namedOut = strcmp(fOut, "-") != 0;
+    HANDLE hIn = IoStdin(), hOut = IoStdout();
+
+    if (strcmp(fIn, "-") != 0) {
+        if (!fileIn.Open(fIn, IO_READ)) {
+            CciFail("Cannot open input file");
+            return FALSE;
+        }
+        hIn = fileIn.Get();
+    }
+    if (namedOut) {
+        if (!fileOut.Open(fOut, IO_CREATE)) {
+            CciFail("Cannot create output file");
+            return FALSE;
+        }
+        hOut = fileOut.Get();
+    }
+
+    size_t size = IoBufSize(hIn, hOut, bufOverride);
+    std::vector<std::unique_ptr<IoBuf> > bufs;
+    StreamRing ring(STREAM_RING);
+    for (unsigned i = 0; i < STREAM_RING; i++) {
+        bufs.push_back(std::unique_ptr<IoBuf>(new IoBuf(ioPool, size)));
+        if (!bufs.back()->Valid()) {
+            CciFail("Cannot allocate buffers");
+            return FALSE;
+        }
+        ring.Slot(i).buf = bufs.back()->Get();
+    }
+
+    CciDigest* dg = cciDigest; // thread_local: the transform stage gets the caller's.
+    std::thread transform([&] {
+        for (unsigned long long i = 0;; i++) {
+            StreamSlot* s = ring.Readable(i);
+            if (s == NULL) break;
+            ApplyDigest(xf, s->buf, s->buf, s->len, s->pos, dg);
+            ring.Transformed();
+        }
+    });
+    std::thread writer([&] {
+        unsigned long long written = 0, synced = 0;
+        for (unsigned long long i = 0;; i++) {
+            StreamSlot* s = ring.Writable(i);
+            if (s == NULL) break;
+            if (!IoWrite(hOut, s->buf, s->len)) {
+                ring.Fail("Write error occurred");
+                break;
+            }
+            written += s->len;
+            if (namedOut) Writeback(hOut, &synced, written, TRUE); // --durability=periodic, (4r).
+            ring.Written();
+        }
+    });
+
+    unsigned long long pos = 0;
+    for (;;) {
+        StreamSlot* s = ring.Free();
+        if (s == NULL) break;
+        size_t n;
+        if (!IoRead(hIn, s->buf, size, &n)) {
+            ring.Fail("Read error occurred");
+            break;
+        }
+        if (n == 0) {
+            ring.Filled(TRUE);
+            break;
+        }
+        s->len = n;
+        s->pos = pos;
+        pos += n;
+        ring.Filled(FALSE);
+    }
+    transform.join();
+    writer.join();
+
+    if (ring.Error() != NULL) {
+        CciFail(ring.Error());
+        return FALSE;
+    }
+    if (namedOut && (!SyncOutput(hOut) || !fileOut.Close())) {
+        CciFail("Cannot flush output file");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// (44a) Parallel mode. The Caesar map has no dependency between bytes, so
+//       the input is cut into MT_CHUNK ranges that workers process
+//       independently: positional read, transform in place, positional write
+//       at the same offset into an output presized to the input length.
+//       Chunk i goes to worker i * nWorkers / nChunks, so each worker starts
+//       on one contiguous stretch. It takes from the front of its own
+//       queue and, when that runs dry, steals from the back of another
+//       worker's queue, so a worker stuck on slow I/O does not hold up the others.
+#define MT_CHUNK (8u << 20)
+
+// (44b) Input length, output presized to it (IoSize, IoSetSize), and
+// (44d) positional I/O (IoReadAt, IoWriteAt: pread/pwrite, or the offset in an
+//       OVERLAPPED on a synchronous handle) come from iofile.h. No shared file
+//       pointer, so workers never race on it.
+
+struct ChunkQueue { // (44e) One per worker. Owner pops the front, thieves pop the back.
+    std::mutex lock;
+    std::deque<unsigned long long> chunks;
+};
+
+static BOOL NextChunk(std::vector<ChunkQueue>& queues, size_t self, unsigned long long* chunk) {
+    {
+        std::lock_guard<std::mutex> guard(queues[self].lock);
+        if (!queues[self].chunks.empty()) {
+            *chunk = queues[self].chunks.front();
+            queues[self].chunks.pop_front();
+            return TRUE;
+        }
+    }
+    for (size_t k = 1; k < queues.size(); k++) { // (44f) Own queue empty: steal.
+        ChunkQueue& victim = queues[(self + k) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.chunks.empty()) {
+            *chunk = victim.chunks.back();
+            victim.chunks.pop_back();
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+struct MtFailure { // First worker failure: the operation that failed and its error.
+    std::atomic<bool> failed;
+    std::mutex lock;
+    const char* what;
+    IoError err; // 0 when there is no system error (short read).
+    MtFailure() : failed(false), what(NULL), err(0) {}
+    void Set(const char* msg, IoError e) {
+        std::lock_guard<std::mutex> g(lock);
+        if (failed) return;
+        what = msg;
+        err = e;
+        failed = true;
+    }
+};
+
+// (44g) One worker: own handles (Win32 serializes I/O on a shared synchronous
+//       handle), one pooled buffer, transform in place.
+static void CipherWorker(LPCSTR fIn, LPCSTR fOut, const Xform* xf, unsigned long long size,
+                         std::vector<ChunkQueue>* queues, size_t self, MtFailure* fail,
+                         std::vector<CciDigest>* digests) {
+    IoFile hIn, hOut;
+    hIn.Open(fIn, IO_READ);
+    hOut.Open(fOut, IO_WRITE);
+    size_t bufSize = IoBufSize(hIn.Get(), hOut.Get(), bufOverride == 0 && directMode ? IODIRECT_BUF : bufOverride);
+    IoBuf buf(ioPool, bufSize);
+    unsigned long long chunk;
+
+    if (!hIn.Valid()) fail->Set("Cannot open input file", IoLastError());
+    else if (!hOut.Valid()) fail->Set("Cannot open output file", IoLastError());
+    else if (!buf.Valid()) fail->Set("Cannot allocate buffer", 0);
+    else if (directMode) { // (4t) Chunks start on MT_CHUNK boundaries, so only the file's tail is unaligned.
+        IoDirectEnable(hIn.Get());
+        IoDirectEnable(hOut.Get());
+    }
+
+    while (!fail->failed && NextChunk(*queues, self, &chunk)) {
+        unsigned long long off = chunk * MT_CHUNK;
+        unsigned long long end = off + MT_CHUNK < size ? off + MT_CHUNK : size;
+        while (off < end && !fail->failed) {
+            size_t want = end - off < bufSize ? (size_t)(end - off) : bufSize, got;
+            if (!IoReadAt(hIn.Get(), buf.Get(), want, off, &got)) {
+                fail->Set("Read error occurred", IoLastError());
+                break;
+            }
+            if (got != want) { // Short read: input changed under us.
+                fail->Set("Read error occurred: input shrank during the copy", 0);
+                break;
+            }
+            ApplyDigest(*xf, buf.Get(), buf.Get(), got, off, digests != NULL ? &(*digests)[(size_t)chunk] : NULL);
+            if (!IoWriteAt(hOut.Get(), buf.Get(), got, off)) {
+                fail->Set("Write error occurred", IoLastError());
+                break;
+            }
+            off += got;
+        }
+        unsigned long long synced = chunk * MT_CHUNK;
+        if (!fail->failed) Writeback(hOut.Get(), &synced, end, FALSE); // Whole chunk done: start its writeback.
+        if (!fail->failed && directMode) {
+            IoDropState dropIn(chunk * MT_CHUNK), dropOut(chunk * MT_CHUNK);
+            IoDropBehind(hIn.Get(), &dropIn, end, false, true);
+            IoDropBehind(hOut.Get(), &dropOut, end, true, true);
+        }
+    }
+}
+
+// (44h) Same contract as cci_f. Inputs that are not regular files, or are
+//       too small to split, go through cci_f unchanged.
+BOOL cci_mt(LPCSTR fIn, LPCSTR fOut, const Xform& xf, unsigned threads) {
+    IoFile hIn, hOut;
+    unsigned long long size = 0;
+
+    if (!IoExists(fIn)) {
+        CciFail("Input file does not exist");
+        return FALSE;
+    }
+    if (!hIn.Open(fIn, IO_READ)) {
+        CciFail("Cannot open input file");
+        return FALSE;
+    }
+    BOOL splittable = IoSize(hIn.Get(), &size) && size >= 2ULL * MT_CHUNK;
+    hIn.Close();
+    if (!splittable) return cci_f(fIn, fOut, xf);
+    cciConsumed = 0;
+
+    if (!hOut.Open(fOut, IO_CREATE)) {
+        CciFail("Cannot create output file");
+        return FALSE;
+    }
+    if (!IoSetSize(hOut.Get(), size)) {
+        CciFail("Cannot size output file");
+        return FALSE;
+    }
+
+    unsigned long long nChunks = (size + MT_CHUNK - 1) / MT_CHUNK;
+    if (threads > nChunks) threads = (unsigned)nChunks;
+    std::vector<ChunkQueue> queues(threads);
+    for (unsigned long long c = 0; c < nChunks; c++)
+        queues[(size_t)(c * threads / nChunks)].chunks.push_back(c);
+
+    MtFailure fail;
+    std::vector<CciDigest> digests(cciDigest != NULL ? (size_t)nChunks : 0, CciDigest{ 0, 0, 0 }); // Per chunk.
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+        workers.push_back(std::thread(CipherWorker, fIn, fOut, &xf, size, &queues, t, &fail,
+                                      cciDigest != NULL ? &digests : NULL));
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+    for (size_t c = 0; c < digests.size(); c++) { // Chunk CRCs joined in file order.
+        cciDigest->crcIn = Crc32cCombine(cciDigest->crcIn, digests[c].crcIn, digests[c].length);
+        cciDigest->crcOut = Crc32cCombine(cciDigest->crcOut, digests[c].crcOut, digests[c].length);
+        cciDigest->length += digests[c].length;
+    }
+
+    BOOL failed = fail.failed;
+    if (failed) { // The worker's own message, with its system error if it had one.
+        static thread_local std::string text;
+        text = fail.what;
+        if (fail.err != 0) text += " (" + IoErrorText(fail.err) + ")";
+        CciFail(text.c_str());
+    }
+    else if (!SyncOutput(hOut.Get())) {
+        CciFail("Cannot flush output file");
+        failed = true;
+    }
+    else if (!hOut.Close()) {
+        CciFail("Write error occurred");
+        failed = true;
+    }
+    if (!failed) cciConsumed = size; // Every chunk read and written in full.
+    return !failed;
+}
+
+// (44i) In-place mode. The transform is a pure byte map, so a file can be
+//       re-keyed where it lies: map it read-write and shift each window in
+//       place. There is no second file and no second buffer, the data is read
+//       once and written once, and no extra disk space is used. The mapping
+//       is walked in MAP_WINDOW pieces so address space stays bounded on
+//       32-bit builds.
+//
+//       In-place mode is not crash-safe: if the process dies midway, the file
+//       is left half shifted. --safe trades the disk space back for
+//       atomicity: the result goes to a temp file next to the target, which
+//       is flushed and then renamed over it.
+#define MAP_WINDOW (64u << 20) // Multiple of the Win32 allocation granularity.
+
+// (44j) Same underlying file: IoSameFile, iofile.h.
+
+// (44k) Transform the first size bytes of h in place through read-write mappings.
+static BOOL MapApply(HANDLE h, unsigned long long size, const Xform& xf) {
+    BOOL ok = TRUE;
+    unsigned long long synced = 0;
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMappingA(h, NULL, PAGE_READWRITE, 0, 0, NULL);
+    if (mapping == NULL) ok = FALSE;
+#endif
+    for (unsigned long long off = 0; ok && off < size; off += MAP_WINDOW) {
+        size_t len = size - off < MAP_WINDOW ? (size_t)(size - off) : MAP_WINDOW;
+#ifdef _WIN32
+        unsigned char* view = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_WRITE,
+                                                            (DWORD)(off >> 32), (DWORD)off, len);
+        if (view == NULL) ok = FALSE;
+        else {
+            ApplyDigest(xf, view, view, len, off, cciDigest);
+            UnmapViewOfFile(view);
+        }
+#else
+        void* view = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, h, (off_t)off);
+        if (view == MAP_FAILED) ok = FALSE;
+        else {
+            madvise(view, len, MADV_SEQUENTIAL);
+            ApplyDigest(xf, (unsigned char*)view, (unsigned char*)view, len, off, cciDigest);
+            munmap(view, len);
+            Writeback(h, &synced, off + len, TRUE);
+        }
+#endif
+    }
+#ifdef _WIN32
+    if (mapping != NULL) CloseHandle(mapping);
+#endif
+    return ok;
+}
+
+// (44l) Atomically replace to with from. POSIX also syncs the directory so
+//       the rename itself survives a crash.
+static BOOL RenameOver(LPCSTR from, LPCSTR to) {
+    if (!IoRename(from, to)) return FALSE;
+    if (durability != DUR_NONE) IoSyncDirOf(to);
+    return TRUE;
+}
+
+// (44m) Without safe, fIn and fOut are the same file and it is shifted in
+//       place through MapApply. With safe, the normal write path (cci_f, or
+//       cci_mt with --threads) builds the result in "<fOut>.cci<pid>"; it is
+//       flushed there and then renamed over fOut, so fOut holds either the old
+//       or the new contents, never a mix. Writing the temp file with write()
+//       rather than through a mapping of a freshly sized file avoids a page
+//       fault per page.
+BOOL cci_inplace(LPCSTR fIn, LPCSTR fOut, const Xform& xf, BOOL safe) {
+    if (safe) {
+        // Rename only a whole result: all of the input read, and all of it in the
+        // temp file. That needs a size to compare against, so the input must be a
+        // regular file; hIn stays open so the check never blocks on a reopen.
+        IoFile hIn, hTmp;
+        unsigned long long inSize = 0, tmpSize = 0;
+        if (!hIn.Open(fIn, IO_READ) || !IoSize(hIn.Get(), &inSize)) {
+            CciFail(hIn.Valid() ? "Input is not a regular file" : "Cannot open input file");
+            return FALSE;
+        }
+        std::string tmp = std::string(fOut) + ".cci" + std::to_string(IoProcessId());
+        BOOL ok = nThreads > 1 ? cci_mt(fIn, tmp.c_str(), xf, nThreads) : cci_f(fIn, tmp.c_str(), xf);
+        if (ok) {
+            ok = IoSize(hIn.Get(), &inSize) && cciConsumed == inSize
+              && hTmp.Open(tmp.c_str(), IO_READ) && IoSize(hTmp.Get(), &tmpSize) && tmpSize == cciConsumed;
+            hTmp.Close();
+            hIn.Close();   // Win32 cannot rename over a file that is still open (in place: fIn is fOut).
+            if (!ok) CciFail("Input not read completely; target left unchanged");
+        }
+        if (ok && (durability == DUR_NONE || durability == DUR_BATCH)) { // Rename must not overtake the data.
+            IoFile h;
+            ok = h.Open(tmp.c_str(), IO_WRITE) && IoSyncData(h.Get());
+            if (!ok) CciFail("Cannot flush output file");
+        }
+        if (ok && !RenameOver(tmp.c_str(), fOut)) {
+            CciFail("Cannot replace output file");
+            ok = FALSE;
+        }
+        if (!ok) IoDelete(tmp.c_str());
+        return ok;
+    }
+
+    IoFile h;
+    unsigned long long size = 0;
+
+    if (!IoExists(fIn)) {
+        CciFail("Input file does not exist");
+        return FALSE;
+    }
+    if (!h.Open(fIn, IO_UPDATE)) {
+        CciFail("Cannot open input file");
+        return FALSE;
+    }
+    if (!IoSize(h.Get(), &size)) {
+        CciFail("Input is not a regular file");
+        return FALSE;
+    }
+    BOOL ok = MapApply(h.Get(), size, xf) && SyncOutput(h.Get()); // (44n) One handle, one mapping.
+    if (ok && directMode) { // Mappings are page cache by definition: evict once written back.
+        IoDropState drop;
+        IoDropBehind(h.Get(), &drop, size, true, true);
+    }
+    ok = h.Close() && ok;
+    if (!ok) CciFail("Write error occurred");
+    return ok;
+}
+
+// (44s) Checksum sidecar: "<file>.crc32c", one line,
+//
+//           crc32c plain=XXXXXXXX cipher=XXXXXXXX length=N
+//
+//       holding the CRC32C of the plaintext and ciphertext sides of the job
+//       that wrote <file>. A later --verify job reading <file> checks its
+//       own in-pass CRCs against it: the side it reads must match what was
+//       written, and the side it produces must match what the first job
+//       started from. For a decrypt job that proves the round trip without
+//       the original plaintext being read again.
+struct CciSidecar {
+    uint32_t plain, cipher;
+    unsigned long long length;
+};
+
+static BOOL ReadSidecar(LPCSTR file, CciSidecar* sc) {
+    std::string path = std::string(file) + ".crc32c";
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == NULL) return FALSE;
+    unsigned plain, cipher;
+    unsigned long long length;
+    BOOL ok = fscanf(f, "crc32c plain=%8x cipher=%8x length=%llu", &plain, &cipher, &length) == 3;
+    fclose(f);
+    sc->plain = plain;
+    sc->cipher = cipher;
+    sc->length = length;
+    return ok;
+}
+
+static BOOL WriteSidecar(LPCSTR file, const CciSidecar& sc) {
+    std::string path = std::string(file) + ".crc32c";
+    FILE* f = fopen(path.c_str(), "w");
+    if (f == NULL) return FALSE;
+    fprintf(f, "crc32c plain=%08x cipher=%08x length=%llu\n", (unsigned)sc.plain, (unsigned)sc.cipher, sc.length);
+    return fclose(f) == 0;
+}
+
+// (44o) One (input, output) job: picks the driver the options ask for.
+//       Naming the same file twice means in place, because cci_f would
+//       truncate its own input. decrypt says which side is plaintext for
+//       the sidecar (44s).
+static BOOL cci_run(LPCSTR fIn, LPCSTR fOut, const Xform& xf, BOOL inPlaceJob, BOOL decrypt) {
+    CciSidecar expect = { 0, 0, 0 };
+    CciDigest dg = { 0, 0, 0 };
+    BOOL stream = strcmp(fIn, "-") == 0 || strcmp(fOut, "-") == 0; // (44u)
+    if (stream && (inPlaceJob || safeWrite || batchMode)) {
+        CciFail("Streaming (-) cannot be combined with --in-place, --safe or --batch");
+        return FALSE;
+    }
+    if ((verifyMode && strcmp(fIn, "-") == 0) || (checksumMode && strcmp(fOut, "-") == 0)) {
+        CciFail("--checksum and --verify need a named file for the sidecar");
+        return FALSE;
+    }
+    if (verifyMode && !ReadSidecar(fIn, &expect)) {
+        CciFail("Cannot read checksum sidecar");
+        return FALSE;
+    }
+
+    if (!stream && !inPlaceJob && IoSameFile(fIn, fOut)) inPlaceJob = TRUE;
+    cciDigest = checksumMode || verifyMode ? &dg : NULL;
+    BOOL ok = stream ? cci_stream(fIn, fOut, xf)
+            : inPlaceJob || safeWrite ? cci_inplace(fIn, fOut, xf, safeWrite)
+            : nThreads > 1 ? cci_mt(fIn, fOut, xf, nThreads)
+            : cci_f(fIn, fOut, xf);
+    cciDigest = NULL;
+    if (!ok) return FALSE;
+
+    CciSidecar got = { decrypt ? dg.crcOut : dg.crcIn, decrypt ? dg.crcIn : dg.crcOut, dg.length };
+    if (verifyMode) {
+        if (got.length != expect.length) {
+            CciFail("Verify failed: length differs from sidecar");
+            return FALSE;
+        }
+        if ((decrypt ? got.cipher != expect.cipher : got.plain != expect.plain)) {
+            CciFail("Verify failed: input differs from what the sidecar recorded");
+            return FALSE;
+        }
+        if ((decrypt ? got.plain != expect.plain : got.cipher != expect.cipher)) {
+            CciFail("Verify failed: output does not round-trip to the recorded data");
+            return FALSE;
+        }
+        if (!batchMode) fprintf(msgOut, "Verified against %s.crc32c\n", fIn);
+    }
+    if (checksumMode && !WriteSidecar(fOut, got)) {
+        CciFail("Cannot write checksum sidecar");
+        return FALSE;
+    }
+    if (strcmp(fOut, "-") != 0) NoteBatchOutput(fOut); // (4s) --durability=batch flushes it at the end.
+    if (checksumMode) NoteBatchOutput(std::string(fOut) + ".crc32c");
+    return TRUE;
+}
+
+// (44p) Transform for a kind and key, as given on the command line or in a
+//       manifest entry. Caesar takes a numeric shift, xor a byte value,
+//       Vigenere the key bytes themselves; rot13 and atbash ignore key.
+static BOOL MakeXform(XformKind kind, BOOL decrypt, LPCSTR key, Xform* xf) {
+    DWORD k = (DWORD)atoi(key);
+    switch (kind) {
+    case XFORM_XOR: *xf = Xform::Xor(k); break;
+    case XFORM_VIGENERE:
+        if (key[0] == '\0') {
+            CciFail("Vigenere needs a non-empty key");
+            return FALSE;
+        }
+        *xf = Xform::Vigenere((const BYTE*)key, strlen(key));
+        break;
+    case XFORM_ROT13: *xf = Xform::Rot13(); break;
+    case XFORM_ATBASH: *xf = Xform::Atbash(); break;
+    default: *xf = Xform::Caesar(k); break;
+    }
+    if (decrypt) *xf = xf->Inverse();
+    return TRUE;
+}
+
+// (44q) Batch mode. A manifest lists one job per line:
+//
+//           <input> <output> <key>
+//
+//       Fields are separated by tabs if the line has any (so names may hold
+//       spaces), else by blanks. The key is the rest of the line. The output is
+//       omitted with --in-place and the key with rot13/atbash. Blank lines and
+//       lines starting with '#' are skipped.
+//
+//       batchJobs workers pull lines from the manifest and run them
+//       through cci_run, so one process handles tens of thousands of small
+//       files. Two limits are admission-controlled before a job starts:
+//       handles (two per job) against --max-open, and input bytes against
+//       --max-inflight. A job larger than the byte limit still runs, just
+//       not alongside others. Failures are reported per entry with the
+//       manifest line number; the run continues and the exit code is 1 if
+//       any entry failed.
+struct BatchEntry {
+    unsigned long line;
+    std::string in, out, key;
+};
+
+class BatchLimits {
+public:
+    BatchLimits(unsigned files, unsigned long long bytes) : maxFiles(files), maxBytes(bytes), files(0), bytes(0) {}
+
+    void Acquire(unsigned f, unsigned long long b) {
+        std::unique_lock<std::mutex> lock(mtx);
+        while ((files != 0 && files + f > maxFiles) || (bytes != 0 && bytes + b > maxBytes)) ready.wait(lock);
+        files += f;
+        bytes += b;
+    }
+
+    void Release(unsigned f, unsigned long long b) {
+        std::lock_guard<std::mutex> lock(mtx);
+        files -= f;
+        bytes -= b;
+        ready.notify_all();
+    }
+
+private:
+    std::mutex mtx;
+    std::condition_variable ready;
+    unsigned maxFiles;
+    unsigned long long maxBytes;
+    unsigned files;
+    unsigned long long bytes;
+};
+
+struct BatchState {
+    FILE* manifest;
+    std::mutex readLock, printLock;
+    unsigned long line;
+    XformKind kind;
+    BOOL decrypt;
+    BatchLimits* limits;
+    std::atomic<unsigned long> entries, failures;
+};
+
+static unsigned long long PathSize(LPCSTR path) { // (44r) 0 when unknown: such jobs cost no budget.
+    unsigned long long size = 0;
+    return IoPathSize(path, &size) ? size : 0;
+}
+
+static std::string NextField(const std::string& s, size_t* p, BOOL tabs) {
+    while (*p < s.size() && (s[*p] == ' ' || s[*p] == '\t')) (*p)++;
+    size_t start = *p;
+    while (*p < s.size() && s[*p] != '\t' && (tabs || s[*p] != ' ')) (*p)++;
+    return s.substr(start, *p - start);
+}
+
+// Next job from the manifest; FALSE at end of input. Caller holds readLock.
+static BOOL NextEntry(BatchState* st, BatchEntry* e) {
+    char chunk[4096];
+    std::string line;
+    for (;;) {
+        line.clear();
+        while (fgets(chunk, sizeof(chunk), st->manifest) != NULL) {
+            line += chunk;
+            if (line[line.size() - 1] == '\n') break;
+        }
+        if (line.empty()) return FALSE;
+        st->line++;
+        while (!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r')) line.erase(line.size() - 1);
+        size_t first = line.find_first_not_of(" \t");
+        if (first == std::string::npos || line[first] == '#') continue;
+
+        BOOL tabs = line.find('\t') != std::string::npos;
+        size_t p = 0;
+        e->line = st->line;
+        e->in = NextField(line, &p, tabs);
+        e->out = inPlace ? e->in : NextField(line, &p, tabs);
+        size_t k = line.find_first_not_of(" \t", p), end = line.find_last_not_of(" \t");
+        e->key = k == std::string::npos ? "" : line.substr(k, end + 1 - k);
+        return TRUE;
+    }
+}
+
+static void BatchWorker(BatchState* st) {
+    BOOL keyless = st->kind == XFORM_ROT13 || st->kind == XFORM_ATBASH;
+    BatchEntry e;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> guard(st->readLock);
+            if (!NextEntry(st, &e)) break;
+        }
+        st->entries++;
+        cciError = NULL;
+        Xform xf;
+        BOOL ok = FALSE;
+        if (e.out.empty() || (e.key.empty() && !keyless && st->kind != XFORM_VIGENERE)) cciError = "Malformed entry";
+        else if (MakeXform(st->kind, st->decrypt, e.key.c_str(), &xf)) {
+            unsigned long long size = PathSize(e.in.c_str());
+            st->limits->Acquire(2, size);
+            ok = cci_run(e.in.c_str(), e.out.c_str(), xf, inPlace, st->decrypt);
+            st->limits->Release(2, size);
+        }
+        if (!ok) {
+            st->failures++;
+            std::lock_guard<std::mutex> guard(st->printLock);
+            printf("line %lu: %s: %s\n", e.line, e.in.c_str(), cciError != NULL ? cciError : "Operation failed");
+        }
+    }
+}
+
+static BOOL cci_batch(LPCSTR manifest, XformKind kind, BOOL decrypt) {
+    FILE* f = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+    if (f == NULL) {
+        printf("Cannot open manifest %s\n", manifest);
+        return FALSE;
+    }
+    BatchLimits limits(batchMaxOpen, batchMaxBytes);
+    BatchState st;
+    st.manifest = f;
+    st.line = 0;
+    st.kind = kind;
+    st.decrypt = decrypt;
+    st.limits = &limits;
+    st.entries = 0;
+    st.failures = 0;
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < batchJobs; t++) workers.push_back(std::thread(BatchWorker, &st));
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+    if (f != stdin) fclose(f);
+
+    BOOL synced = SyncBatch();
+    printf("%lu entries processed, %lu failed\n", (unsigned long)st.entries, (unsigned long)st.failures);
+    return st.failures == 0 && synced;
+}
+
+// (44t) Key detection. A Caesar (or xor) key maps every plaintext byte
+//       value to one ciphertext value, so the ciphertext histogram is the
+//       plaintext histogram permuted by the key. One pass builds the
+//       histogram; every candidate key k is then scored by the
+//       log-likelihood of the histogram under a reference distribution,
+//       sum over c of hist[c] * log P(plain(c, k)), which is 256 x 256
+//       multiply-adds however large the file is. This replaces running
+//       cci_f once per candidate key.
+//
+//       The reference is the byte histogram of a corpus file (--detect=FILE,
+//       e.g. src_rst/plain.txt) with add-half smoothing so bytes the corpus
+//       never shows are unlikely rather than impossible, or a built-in
+//       English text profile. --sample=SIZE histograms SIZE bytes taken as
+//       evenly spaced DETECT_PIECE pieces instead of the whole file.
+#define DETECT_PIECE (64u << 10)
+
+// Byte histogram of p[0..n) added into hist. Four sub-tables, one per byte
+// lane of each 32-bit half, so consecutive equal bytes do not serialize on
+// the same counter; they are summed once at the end. (Byte histograms do
+// not vectorize profitably; this is the usual fast scalar form.)
+static void ByteHistogram(const unsigned char* p, size_t n, unsigned long long hist[256]) {
+    std::vector<uint32_t> h(4 * 256, 0);
+    uint32_t* h0 = &h[0];
+    uint32_t* h1 = &h[256];
+    uint32_t* h2 = &h[512];
+    uint32_t* h3 = &h[768];
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p + i, 4);
+        memcpy(&hi, p + i + 4, 4);
+        h0[lo & 0xFF]++; h1[(lo >> 8) & 0xFF]++; h2[(lo >> 16) & 0xFF]++; h3[lo >> 24]++;
+        h0[hi & 0xFF]++; h1[(hi >> 8) & 0xFF]++; h2[(hi >> 16) & 0xFF]++; h3[hi >> 24]++;
+    }
+    for (; i < n; i++) h0[p[i]]++;
+    for (int b = 0; b < 256; b++) hist[b] += (unsigned long long)h0[b] + h1[b] + h2[b] + h3[b];
+}
+
+struct DetectRange {
+    unsigned long long off, len;
+};
+
+// One histogram thread: chunks come from the same work-stealing queues as
+// cci_mt; counts go into this thread's own table, merged by the caller.
+static void DetectWorker(LPCSTR fIn, const std::vector<DetectRange>* ranges, std::vector<ChunkQueue>* queues,
+                         size_t self, std::atomic<bool>* failed, unsigned long long* hist) {
+    IoFile hIn;
+    hIn.Open(fIn, IO_READ);
+    size_t bufSize = IoBufSize(hIn.Get(), INVALID_HANDLE_VALUE, bufOverride);
+    IoBuf buf(ioPool, bufSize);
+    unsigned long long chunk;
+
+    if (!hIn.Valid() || !buf.Valid()) *failed = true;
+    while (!*failed && NextChunk(*queues, self, &chunk)) {
+        unsigned long long off = (*ranges)[(size_t)chunk].off, end = off + (*ranges)[(size_t)chunk].len;
+        while (off < end) {
+            size_t want = end - off < bufSize ? (size_t)(end - off) : bufSize, got;
+            if (!IoReadAt(hIn.Get(), buf.Get(), want, off, &got) || got != want) {
+                *failed = true;
+                break;
+            }
+            ByteHistogram(buf.Get(), got, hist);
+            off += got;
+        }
+    }
+}
+
+// Histogram of a regular file, or of sample bytes of it (0 = all), on
+// nThreads threads.
+static BOOL HistogramFile(LPCSTR path, unsigned long long sample, unsigned long long hist[256],
+                          unsigned long long* counted) {
+    unsigned long long size = 0;
+    IoFile h;
+    if (!h.Open(path, IO_READ) || !IoSize(h.Get(), &size)) {
+        CciFail("Cannot read input file (must be a regular file)");
+        return FALSE;
+    }
+
+    std::vector<DetectRange> ranges;
+    if (sample == 0 || sample >= size || size <= DETECT_PIECE) {
+        for (unsigned long long off = 0; off < size; off += MT_CHUNK)
+            ranges.push_back(DetectRange{ off, size - off < MT_CHUNK ? size - off : MT_CHUNK });
+    }
+    else {
+        unsigned long long pieces = (sample + DETECT_PIECE - 1) / DETECT_PIECE;
+        for (unsigned long long i = 0; i < pieces; i++)
+            ranges.push_back(DetectRange{ (size - DETECT_PIECE) / (pieces > 1 ? pieces - 1 : 1) * i, DETECT_PIECE });
+    }
+
+    size_t threads = nThreads < ranges.size() ? nThreads : ranges.size();
+    if (threads == 0) threads = 1;
+    std::vector<ChunkQueue> queues(threads);
+    for (size_t c = 0; c < ranges.size(); c++) queues[c * threads / ranges.size()].chunks.push_back(c);
+    std::vector<unsigned long long> partial(threads * 256, 0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+        workers.push_back(std::thread(DetectWorker, path, &ranges, &queues, t, &failed, &partial[t * 256]));
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+    if (failed) {
+        CciFail("Read error occurred");
+        return FALSE;
+    }
+
+    *counted = 0;
+    for (int b = 0; b < 256; b++) {
+        hist[b] = 0;
+        for (size_t t = 0; t < threads; t++) hist[b] += partial[t * 256 + b];
+        *counted += hist[b];
+    }
+    return TRUE;
+}
+
+// Built-in reference: relative weights for English prose in ASCII.
+static void EnglishProfile(double w[256]) {
+    static const double letters[26] = { // a..z, percent
+        8.17, 1.29, 2.78, 4.25, 12.70, 2.23, 2.02, 6.09, 6.97, 0.15, 0.77, 4.03, 2.41,
+        6.75, 7.51, 1.93, 0.10, 5.99, 6.33, 9.06, 2.76, 0.98, 2.36, 0.15, 1.97, 0.07 };
+    for (int b = 0; b < 256; b++) w[b] = 0.001;              // anything at all
+    for (int b = 0x21; b < 0x7F; b++) w[b] = 0.05;           // printable ASCII
+    for (int b = '0'; b <= '9'; b++) w[b] = 0.3;
+    for (int i = 0; i < 26; i++) {
+        w['a' + i] = letters[i];
+        w['A' + i] = letters[i] * 0.08;
+    }
+    w[' '] = 18.0;
+    w['\n'] = 2.0;
+    w['.'] = 1.0;
+    w[','] = 1.0;
+}
+
+static BOOL cci_detect(LPCSTR fIn, LPCSTR fOut, XformKind kind, LPCSTR ref, unsigned long long sample) {
+    unsigned long long hist[256], counted = 0;
+    double logp[256], w[256], total = 0;
+
+    if (ref != NULL) {
+        unsigned long long refHist[256], refCount = 0;
+        if (!HistogramFile(ref, 0, refHist, &refCount)) return FALSE;
+        for (int b = 0; b < 256; b++) w[b] = (double)refHist[b] + 0.5;
+    }
+    else EnglishProfile(w);
+    for (int b = 0; b < 256; b++) total += w[b];
+    for (int b = 0; b < 256; b++) logp[b] = log(w[b] / total);
+
+    if (!HistogramFile(fIn, sample, hist, &counted)) return FALSE;
+
+    double score[256];
+    int best = 0, second = 1;
+    for (int k = 0; k < 256; k++) {
+        score[k] = 0;
+        for (int c = 0; c < 256; c++) {
+            if (hist[c] == 0) continue;
+            int plain = kind == XFORM_XOR ? c ^ k : (c - k) & 0xFF;
+            score[k] += (double)hist[c] * logp[plain];
+        }
+    }
+    if (score[second] > score[best]) { best = 1; second = 0; }
+    for (int k = 2; k < 256; k++) {
+        if (score[k] > score[best]) { second = best; best = k; }
+        else if (score[k] > score[second]) second = k;
+    }
+    double margin = counted > 0 ? (score[best] - score[second]) / (double)counted / log(2.0) : 0;
+    fprintf(msgOut, "Detected %s key %d over %llu bytes (%.3f bits/byte ahead of %d)\n",
+           xformKindNames[kind], best, counted, margin, second);
+
+    if (fOut == NULL) return TRUE;
+    Xform xf = kind == XFORM_XOR ? Xform::Xor((DWORD)best) : Xform::Caesar((DWORD)best).Inverse();
+    return cci_run(fIn, fOut, xf, FALSE, TRUE);
+}
+
 int main(int argc, char* argv[]) // (45) `main` function entry point. `argc`, `argv` passed
     // `int main(int argc, char* argv[])` (45.1): Standard C++ main signature.
         // `int`: Return type. Exit code to OS.
@@ -167,29 +1254,144 @@ int main(int argc, char* argv[]) // (45) `main` function entry point. `argc`, `a
 
 { // (46) Start main function scope.
 
-    if (argc != 4) { // (47) Argument count check. Integer comparison.
-        // `argc != 4` (47.1): Comparison of integer `argc` with constant 4.
-        printf("Usage: %s <input> <output> <shift>\n", argv[0]); // (48) `printf` usage message. `argv[0]` program name.
+    int iArg = 1; // (46a) Index of the first positional argument.
+    XformKind kind = XFORM_CAESAR; // (46c) --xform=NAME; Caesar unless told otherwise.
+    BOOL decrypt = FALSE;          // (46d) --decrypt applies the inverse transform.
+    LPCSTR manifest = NULL;        // (46f) --batch=FILE, "-" for stdin.
+    BOOL detect = FALSE;           // (46g) --detect[=REF]: find the key instead of applying one.
+    LPCSTR detectRef = NULL;       //       Reference corpus; NULL = built-in English profile.
+    unsigned long long sample = 0; //       --sample=SIZE; 0 = whole file.
+    for (; iArg < argc && strncmp(argv[iArg], "--", 2) == 0; iArg++) { // (46b) Leading options.
+        if (strncmp(argv[iArg], "--bufsize=", 10) == 0) {
+            bufOverride = IoParseSize(argv[iArg] + 10);
+            if (bufOverride == 0) {
+                printf("Bad buffer size %s\n", argv[iArg] + 10);
+                return 1;
+            }
+        }
+        else if (strncmp(argv[iArg], "--threads=", 10) == 0) {
+            nThreads = (unsigned)atoi(argv[iArg] + 10);
+            if (nThreads == 0) nThreads = std::thread::hardware_concurrency();
+            if (nThreads == 0) nThreads = 1;
+        }
+        else if (strcmp(argv[iArg], "--in-place") == 0) {
+            inPlace = TRUE;
+        }
+        else if (strcmp(argv[iArg], "--safe") == 0) {
+            safeWrite = TRUE;
+        }
+        else if (strncmp(argv[iArg], "--xform=", 8) == 0) {
+            int k = XFORM_CAESAR;
+            while (k <= XFORM_ATBASH && strcmp(argv[iArg] + 8, xformKindNames[k]) != 0) k++;
+            if (k > XFORM_ATBASH) {
+                printf("Unknown transform %s\n", argv[iArg] + 8);
+                return 1;
+            }
+            kind = (XformKind)k;
+        }
+        else if (strcmp(argv[iArg], "--decrypt") == 0) {
+            decrypt = TRUE;
+        }
+        else if (strncmp(argv[iArg], "--durability=", 13) == 0) {
+            int d = DUR_NONE;
+            while (d <= DUR_BATCH && strcmp(argv[iArg] + 13, durabilityNames[d]) != 0) d++;
+            if (d > DUR_BATCH) {
+                printf("Unknown durability %s\n", argv[iArg] + 13);
+                return 1;
+            }
+            durability = d;
+        }
+        else if (strcmp(argv[iArg], "--detect") == 0 || strncmp(argv[iArg], "--detect=", 9) == 0) {
+            detect = TRUE;
+            detectRef = argv[iArg][8] == '=' ? argv[iArg] + 9 : NULL;
+        }
+        else if (strncmp(argv[iArg], "--sample=", 9) == 0) {
+            sample = IoParseSize(argv[iArg] + 9);
+        }
+        else if (strcmp(argv[iArg], "--direct") == 0) {
+            directMode = TRUE;
+        }
+        else if (strcmp(argv[iArg], "--checksum") == 0) {
+            checksumMode = TRUE;
+        }
+        else if (strcmp(argv[iArg], "--verify") == 0) {
+            verifyMode = TRUE;
+        }
+        else if (strncmp(argv[iArg], "--batch=", 8) == 0) {
+            batchMode = TRUE;
+            manifest = argv[iArg] + 8;
+        }
+        else if (strncmp(argv[iArg], "--jobs=", 7) == 0) {
+            batchJobs = (unsigned)atoi(argv[iArg] + 7);
+            if (batchJobs == 0) batchJobs = 1;
+        }
+        else if (strncmp(argv[iArg], "--max-open=", 11) == 0) {
+            batchMaxOpen = (unsigned)atoi(argv[iArg] + 11);
+        }
+        else if (strncmp(argv[iArg], "--max-inflight=", 15) == 0) {
+            batchMaxBytes = IoParseSize(argv[iArg] + 15);
+        }
+        else {
+            printf("Unknown option %s\n", argv[iArg]);
+            return 1;
+        }
+    }
+
+    BOOL keyless = kind == XFORM_ROT13 || kind == XFORM_ATBASH; // (46e) Fixed maps take no key.
+
+    BOOL badArgs = batchMode ? argc != iArg
+                 : detect ? argc - iArg < 1 || argc - iArg > 2 || (kind != XFORM_CAESAR && kind != XFORM_XOR)
+                 : argc - iArg != 3 - (inPlace ? 1 : 0) - (keyless ? 1 : 0);
+    if (badArgs) { // (47) Argument count check.
+        // (47.1): Input, output and key; --in-place drops the output name and
+        //         fixed maps drop the key. --batch takes none: jobs come from the manifest.
+        //         --detect takes the input and, to decrypt as well, an output.
+        printf("Usage: %s [options] <input> <output> <key>\n"
+               "       %s [options] --in-place <file> <key>\n"
+               "       %s [options] --batch=<manifest|-> [--jobs=N] [--max-open=N] [--max-inflight=SIZE]\n"
+               "       %s [--xform=caesar|xor] --detect[=<reference>] [--sample=SIZE] <input> [<output>]\n"
+               "Streaming: - as <input> and/or <output> is stdin/stdout (messages then go to stderr).\n"
+               "Options: --bufsize=N --threads=N --safe --decrypt --checksum --verify --direct\n"
+               "         --durability=none|data|periodic|full|batch (default full: fsync every file)\n"
+               "         --xform=caesar|xor|vigenere|rot13|atbash (default caesar)\n"
+               "Key: caesar shift, xor byte value, vigenere key string; rot13 and atbash take none.\n"
+               "Manifest lines: <input> <output> <key>, tab-separated if names contain spaces.\n",
+               argv[0], argv[0], argv[0], argv[0]); // (48) `printf` usage message. `argv[0]` program name.
             // `printf(...)`: Output to stdout, buffered. May involve system calls.
             // `%s`: Format specifier, string pointer from `argv[0]` is dereferenced.
         return 1; // (49) Return integer 1, indicating error to OS.
     } // (50) End if. Conditional jump.
 
-    DWORD shift = (DWORD)atoi(argv[3]); // (51) `atoi` call to convert string to integer.
-        // `atoi(argv[3])` (51.1): Function call to `atoi` from stdlib. String conversion.
-        // `(DWORD)(...)` (51.2): Explicit type cast to DWORD. Potential truncation if result exceeds DWORD range.
+    if (batchMode) return cci_batch(manifest, kind, decrypt) ? 0 : 1; // (50c) Per-entry report instead of (53).
+    if (detect) { // (50d) Report the key; decrypt into the output if one was named.
+        if (argc - iArg == 2 && strcmp(argv[iArg + 1], "-") == 0) msgOut = stderr; // (4u)
+        BOOL found = cci_detect(argv[iArg], argc - iArg == 2 ? argv[iArg + 1] : NULL, kind, detectRef, sample);
+        return found && SyncBatch() ? 0 : 1;
+    }
+
+    LPCSTR fIn = argv[iArg], fOut = inPlace ? argv[iArg] : argv[iArg + 1]; // (50a) Same name when in place.
+    LPCSTR key = keyless ? "" : argv[argc - 1]; // (50b) Key is always the last argument.
+    if (strcmp(fOut, "-") == 0) msgOut = stderr; // (50e) Streaming to stdout, (4u).
+
+    Xform xf; // (51) Transform from kind and key; the key stream and kernels are set up once, here.
+    if (!MakeXform(kind, decrypt, key, &xf)) return 1;
+        // (51.1) Caesar and xor keys go through `atoi`: locale-dependent,
+        //        cast to DWORD, so values beyond DWORD range truncate.
+
+    BOOL ok = cci_run(fIn, fOut, xf, inPlace, decrypt); // (51b) In place / temp + rename, parallel, else serial.
+    if (!SyncBatch()) ok = FALSE; // (51d) --durability=batch: a single run is a batch of one.
 
-    if (!cci_f(argv[1], argv[2], shift)) { // (52) Call to `cci_f` function. Function call overhead.
-        // `cci_f(argv[1], argv[2], shift)` (52.1): Function call. Arguments passed (pointers and DWORD).
-            // `argv[1]`: Input filename string pointer.
-            // `argv[2]`: Output filename string pointer.
-            // `shift`: DWORD shift value.
-        // `!cci_f(...)` (52.2): Logical NOT of `cci_f` return value. Check for failure.
+    if (!ok) { // (52) Result of `cci_run`.
+        // `cci_run(fIn, fOut, xf, inPlace, decrypt)` (52.1): Function call. Arguments passed (pointers and reference).
+            // `fIn`: Input filename string pointer.
+            // `fOut`: Output filename string pointer.
+            // `xf`: Transform built at (51).
+        // `!ok` (52.2): Logical NOT of the return value. Check for failure.
 
-        printf("Operation failed\n"); // (53) `printf` error message.
+        fprintf(msgOut, "Operation failed\n"); // (53) `fprintf` error message, to msgOut (4u).
         return 1; // (54) Return 1 on `cci_f` failure.
     } // (55) End if. Conditional jump.
 
-    printf("File processed successfully\n"); // (56) `printf` success message.
+    fprintf(msgOut, "File processed successfully\n"); // (56) Success message, to msgOut (4u).
     return 0; // (57) Return 0, indicating successful program execution.
 } // (58) End main function scope. Program termination. OS reclaims resources.
\ No newline at end of file
@@ -0,0 +1,166 @@
+// crc32c.h - CRC32C (Castagnoli) for cipher.cpp's --checksum / --verify.
+//
+// Crc32c(crc, p, n) continues crc over p[0..n); Crc32c(0, p, n) is the
+// standard CRC32C of p, and Crc32c(Crc32c(0, a, na), b, nb) that of a||b.
+// Crc32cCombine joins two CRCs computed independently (parallel chunks).
+//
+// Kernels: SSE4.2 CRC32 instruction when CPUID says so, else slicing-by-8
+// with tables built at compile time. The hardware path runs three
+// independent streams over consecutive 4 KB blocks to hide the
+// instruction's 3-cycle latency, then shifts the first two into place
+// with a precomputed "append 4 KB of zeros" operator.
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "xform.h"   // XFORM_X86, XFORM_TARGET, XformCpuid
+
+#define CRC32C_POLY 0x82F63B78u   // reflected 0x1EDC6F41
+#define CRC32C_BLOCK 4096         // bytes per stream per round (hardware path)
+
+struct Crc32cTables {
+    uint32_t t[8][256];
+};
+
+static constexpr Crc32cTables Crc32cMakeTables() {
+    Crc32cTables tab = {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+        tab.t[0][i] = c;
+    }
+    for (int s = 1; s < 8; s++)
+        for (int i = 0; i < 256; i++)
+            tab.t[s][i] = (tab.t[s - 1][i] >> 8) ^ tab.t[0][tab.t[s - 1][i] & 0xFF];
+    return tab;
+}
+
+template <int Unused = 0>
+struct Crc32cTable {
+    static constexpr Crc32cTables tab = Crc32cMakeTables();
+};
+template <int Unused>
+constexpr Crc32cTables Crc32cTable<Unused>::tab;
+
+// Raw kernels: no pre/post inversion, so they compose linearly.
+static inline uint32_t Crc32cSwRaw(uint32_t c, const unsigned char* p, size_t n) {
+    const uint32_t (*t)[256] = Crc32cTable<>::tab.t;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);       // little-endian hosts only, as for the rest of src_cpp
+        memcpy(&hi, p + 4, 4);
+        lo ^= c;
+        c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24]
+          ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+    for (; n > 0; n--, p++) c = (c >> 8) ^ t[0][(c ^ *p) & 0xFF];
+    return c;
+}
+
+// GF(2) 32x32 matrix helpers (as in zlib's crc32_combine). mat[i] is the
+// image of bit i.
+static inline uint32_t Crc32cMatTimes(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    for (; vec != 0; vec >>= 1, mat++)
+        if (vec & 1) sum ^= *mat;
+    return sum;
+}
+
+static inline void Crc32cMatSquare(uint32_t* sq, const uint32_t* mat) {
+    for (int i = 0; i < 32; i++) sq[i] = Crc32cMatTimes(mat, mat[i]);
+}
+
+// Operator that appends len zero bytes to a raw CRC state.
+static inline void Crc32cZeros(uint32_t* op, unsigned long long len) {
+    uint32_t odd[32], even[32];
+    odd[0] = CRC32C_POLY;                        // one zero bit
+    for (int i = 1; i < 32; i++) odd[i] = 1u << (i - 1);
+    Crc32cMatSquare(even, odd);                  // two bits
+    Crc32cMatSquare(odd, even);                  // four bits
+    for (int i = 0; i < 32; i++) op[i] = 1u << i;
+    uint32_t* sq = odd;
+    uint32_t* other = even;
+    for (; len != 0; len >>= 1) {                // odd/even now alternate as 8, 16, 32... bits
+        Crc32cMatSquare(other, sq);
+        uint32_t* t = sq; sq = other; other = t;
+        if (len & 1) {
+            uint32_t prod[32];
+            for (int i = 0; i < 32; i++) prod[i] = Crc32cMatTimes(sq, op[i]);
+            memcpy(op, prod, sizeof(prod));
+        }
+    }
+}
+
+// CRC of a||b from crc1 = CRC(a), crc2 = CRC(b) and len2 = |b|.
+static inline uint32_t Crc32cCombine(uint32_t crc1, uint32_t crc2, unsigned long long len2) {
+    if (len2 == 0) return crc1;
+    uint32_t op[32];
+    Crc32cZeros(op, len2);
+    return Crc32cMatTimes(op, crc1) ^ crc2;
+}
+
+#ifdef XFORM_X86
+XFORM_TARGET("sse4.2")
+static inline uint32_t Crc32cHwStream(uint32_t c, const unsigned char* p, size_t n) {
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t c64 = c;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c64 = _mm_crc32_u64(c64, v);
+    }
+    c = (uint32_t)c64;
+#endif
+    for (; n >= 4; n -= 4, p += 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        c = _mm_crc32_u32(c, v);
+    }
+    for (; n > 0; n--, p++) c = _mm_crc32_u8(c, *p);
+    return c;
+}
+
+XFORM_TARGET("sse4.2")
+static inline uint32_t Crc32cHwRaw(uint32_t c, const unsigned char* p, size_t n) {
+    static uint32_t shift1[32], shift2[32];      // append one / two blocks of zeros
+    static const bool ready = (Crc32cZeros(shift1, CRC32C_BLOCK), Crc32cZeros(shift2, 2 * CRC32C_BLOCK), true);
+    (void)ready;
+#if defined(__x86_64__) || defined(_M_X64)
+    for (; n >= 3 * CRC32C_BLOCK; n -= 3 * CRC32C_BLOCK, p += 3 * CRC32C_BLOCK) {
+        uint64_t a = c, b = 0, d = 0;
+        for (size_t i = 0; i < CRC32C_BLOCK; i += 8) {
+            uint64_t va, vb, vd;
+            memcpy(&va, p + i, 8);
+            memcpy(&vb, p + CRC32C_BLOCK + i, 8);
+            memcpy(&vd, p + 2 * CRC32C_BLOCK + i, 8);
+            a = _mm_crc32_u64(a, va);
+            b = _mm_crc32_u64(b, vb);
+            d = _mm_crc32_u64(d, vd);
+        }
+        c = Crc32cMatTimes(shift2, (uint32_t)a) ^ Crc32cMatTimes(shift1, (uint32_t)b) ^ (uint32_t)d;
+    }
+#endif
+    return Crc32cHwStream(c, p, n);
+}
+
+static inline bool Crc32cHwAvailable() {
+    unsigned int r[4];
+    XformCpuid(1, 0, r);
+    return (r[2] & (1u << 20)) != 0;             // SSE4.2
+}
+#endif
+
+static inline uint32_t Crc32c(uint32_t crc, const void* data, size_t n) {
+    const unsigned char* p = (const unsigned char*)data;
+#ifdef XFORM_X86
+    static const bool hw = Crc32cHwAvailable();
+    if (hw) return ~Crc32cHwRaw(~crc, p, n);
+#endif
+    return ~Crc32cSwRaw(~crc, p, n);
+}
+
+#endif
@@ -1,40 +1,71 @@
-#include <windows.h>
-#include <tchar.h>
 #include <stdio.h>
+#include <math.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "iofile.h"
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+// [0] iofile.h: portable file I/O shared with cat.cpp and cipher.cpp.
+// Win32 handles or POSIX fds underneath, chosen at compile time, so the
+// same source builds on both. Also supplies IoReportError, the common
+// "ERROR: msg (system text)" reporter.
 
-void ReportError(LPCTSTR msg, DWORD exitCode, BOOL exitProgram);
+void Fatal(LPCTSTR msg, int exitCode);
 void ReportSpace(LPCTSTR Message);
+static int RunMode(int argc, LPTSTR argv[]);
 
 int _tmain(int argc, LPTSTR argv[]) {
     // [1] _tmain: Entry point. Standard for Unicode Win32 console apps.
-    // Args: argc (count), argv (values). Unused here.
+    // Args: argc (count), argv (values). Any argument selects a scripted mode, see [60].
     // Range: Program execution lifespan. Mem: Stack frame. Comp: O(1).
     // Flow: Program start -> main loop.
     // Narrative: Program begins, initializes, enters file size loop.
 
-    HANDLE hFile;
+    IoFile hFile;
     // [2] hFile: File handle. Represents file object in OS.
-    // Type: HANDLE (void*). Justify: OS file API type.
-    // Range: Valid file handle or INVALID_HANDLE_VALUE (-1).
-    // Mem: Pointer size (4B or 8B). Comp: O(1) access. Flow: CreateFile -> WriteFile -> CloseHandle.
+    // Type: IoFile (iofile.h): owns a Win32 HANDLE or a POSIX fd and closes it
+    // in its destructor, so no exit path leaks it.
+    // Range: Valid handle or INVALID_HANDLE_VALUE (-1).
+    // Mem: Pointer size (4B or 8B). Comp: O(1) access. Flow: Open -> IoSetSize -> IoWriteAt -> Close.
     // Real-world: File descriptor, like index to OS file table.
-    // Edge: INVALID_HANDLE_VALUE. Trigger: CreateFile failure.
+    // Edge: Open failure. Trigger: file exists, permissions, disk full.
     // Response: Error report, program exit. Analyze: Prevents file operations.
 
-    LARGE_INTEGER FileLen, FileLenH;
+    long long FileLen, FileLenH;
     // [3] FileLen: Desired file length. 64-bit integer for large files.
-    // Type: LARGE_INTEGER (union). Justify: Needs > 4GB file size support.
+    // Type: long long. Justify: Needs > 4GB file size support.
     // Range: 0 to 2^63 - 1 bytes (max file size). Mem: 8B. Comp: O(1).
-    // Flow: Input -> SetFilePointerEx.
+    // Flow: Input -> IoSetSize.
     // Real-world: Max file size on NTFS ~ 16EB (exabytes), limited by OS/FS.
-    // Edge: Negative input? _tscanf_s behavior. Assume unsigned input effectively.
+    // Edge: Negative input? Treated like 0: quit.
     // Edge: Very large input? Disk space limit.
     // Flow: User input dictates file size.
 
     // [4] FileLenH: Half of FileLen. Used for writing to middle.
-    // Type: LARGE_INTEGER. Justify: Same type as FileLen for arithmetic.
-    // Range: 0 to (2^63 - 1) / 2. Mem: 8B. Comp: O(1). Flow: FileLen -> Calculation -> ov.Offset.
+    // Type: long long. Justify: Same type as FileLen for arithmetic.
+    // Range: 0 to (2^63 - 1) / 2. Mem: 8B. Comp: O(1). Flow: FileLen -> Calculation -> IoWriteAt offset.
     // Real-world: Midpoint calculation for file write.
     // Calculation: FileLenH = FileLen / 2. Integer division.
     // Pitfall: Integer division truncation. If FileLen is odd, FileLenH is floor(FileLen/2).
@@ -42,38 +73,31 @@ int _tmain(int argc, LPTSTR argv[]) {
     BYTE Buffer[256];
     // [5] Buffer: Write buffer. 256 bytes.
     // Type: BYTE[256] (unsigned char array). Justify: Small write unit, fixed size.
-    // Range: 256 bytes. Mem: 256B (stack). Comp: O(1) access. Flow: WriteFile.
+    // Range: 256 bytes. Mem: 256B (stack). Comp: O(1) access. Flow: IoWriteAt.
     // Real-world: Small chunk of data to write.
-    // Size: 256 bytes. Trade-off: Small, but WriteFile can write less.
+    // Size: 256 bytes. IoWriteAt writes all of it or fails.
     // Assume: Buffer content is irrelevant (overwritten file).
 
-    OVERLAPPED ov = { 0 };
-    // [6] ov: Overlapped structure for asynchronous file I/O (unused here).
-    // Type: OVERLAPPED. Justify: Required for WriteFile even in sync mode if offset used.
-    // Mem: OS-dependent struct size (min 24B on x64). Comp: O(1) access. Flow: WriteFile.
-    // Roles: Offset control for WriteFile. Initialized to 0 except offset.
-    // Hierarchy: struct OVERLAPPED { ... Offset, OffsetHigh ... }. Flat struct.
-    // Size: 24B (x64 min). Trade-off: Overhead for offset control.
-    // Note: Overlapped I/O not truly used as no async flags set in CreateFile.
-
-    DWORD nWrite;
-    // [7] nWrite: Bytes actually written by WriteFile.
-    // Type: DWORD (unsigned long, 4B). Justify: WriteFile output parameter type.
-    // Range: 0 to 256 (or less if error). Mem: 4B. Comp: O(1). Flow: WriteFile -> unused.
-    // Real-world: Count of bytes successfully written to file.
-    // Note: Not checked for errors or used after WriteFile call.
+    // [6] (was ov, an OVERLAPPED holding the write offset) IoWriteAt takes the
+    // offset directly: an OVERLAPPED on Win32, pwrite on POSIX.
+    // [7] (was nWrite) IoWriteAt loops until every byte is written, so there is
+    // no partial count left for the caller to check.
+
+    if (argc > 1) return RunMode(argc, argv);
+    // [7a] Arguments: run one scripted mode ([60]) and exit instead of
+    // prompting. No arguments: the interactive loop below, unchanged.
 
     while (1) {
         // [8] while (1): Infinite loop. Continues until user enters 0.
         // Predicate: Always true initially. Invariant: Program runs until user quits.
-        // Term: 'break' statement when FileLen.QuadPart == 0.
+        // Term: 'break' statement when FileLen <= 0.
         // Work: File creation, resizing, writing, cleanup cycle.
         // Pitfall: Infinite loop if 'break' condition never met (but user input ensures termination).
         // Real-world: Program main loop, event loop style (though input driven here).
 
-        FileLen.QuadPart = 0;
-        // [9] FileLen.QuadPart = 0: Reset file length at loop start.
-        // Operation: Assignment. Comp: O(1). Flow: Loop start -> _tscanf_s.
+        FileLen = 0;
+        // [9] FileLen = 0: Reset file length at loop start.
+        // Operation: Assignment. Comp: O(1). Flow: Loop start -> _tscanf.
         // Purpose: Clear previous file size from prior iteration.
         // Invariant: FileLen starts at 0 each loop.
 
@@ -83,17 +107,18 @@ int _tmain(int argc, LPTSTR argv[]) {
         // Purpose: Guide user interaction.
         // Real-world: User interface text prompt.
 
-        _tscanf_s(_T("%I64d"), &FileLen.QuadPart);
-        // [11] _tscanf_s: Reads 64-bit integer from user input into FileLen.QuadPart.
+        if (_tscanf(_T("%lld"), &FileLen) != 1) FileLen = 0;
+        // [11] _tscanf: Reads 64-bit integer from user input into FileLen.
         // Operation: Input from console. Comp: O(log N) input digits, console I/O, parsing. Flow: User input -> FileLen.
         // Predicate: Waits for user input and Enter key.
-        // Edge: Non-numeric input? _tscanf_s behavior (error, program might proceed with 0).
-        // Edge: Input overflow? (very large number). _tscanf_s behavior (potential overflow or clamping).
+        // Edge: Non-numeric input or end of input: treated as 0, so the loop ends
+        // instead of spinning on the same unread characters.
+        // Edge: Input overflow? (very large number). scanf behavior (potential overflow or clamping).
         // Assume: User enters valid 64-bit integer or 0 to quit.
 
-        if (FileLen.QuadPart == 0)
-            // [12] if (FileLen.QuadPart == 0): Check for user quit condition.
-            // Predicate: FileLen.QuadPart == 0. Comp: O(1) comparison. Flow: FileLen -> break/continue.
+        if (FileLen <= 0)
+            // [12] if (FileLen <= 0): Check for user quit condition.
+            // Predicate: FileLen <= 0 (negative sizes are meaningless). Comp: O(1) comparison. Flow: FileLen -> break/continue.
             // Purpose: Termination condition for loop.
             // Real-world: User command to exit program.
 
@@ -102,14 +127,14 @@ int _tmain(int argc, LPTSTR argv[]) {
         // Operation: Control flow jump. Comp: O(1). Flow: if condition true -> loop exit.
         // Purpose: Terminate program loop when user enters 0.
 
-        _tprintf(_T("\nRequested file size: %,20I64d bytes\n"), FileLen.QuadPart);
+        _tprintf(_T("\nRequested file size: %20lld bytes\n"), FileLen);
         // [14] _tprintf: Echo user input file size to console.
         // Operation: Output to console. Comp: O(log N) number formatting, console I/O. Flow: FileLen -> Output.
         // Purpose: Confirm user input.
-        // Format: %,20I64d: comma separators, 20 chars width, 64-bit integer.
+        // Format: %20lld: 20 chars width, 64-bit integer.
 
-        FileLenH.QuadPart = FileLen.QuadPart / 2;
-        // [15] FileLenH.QuadPart = FileLen.QuadPart / 2: Calculate half file size.
+        FileLenH = FileLen / 2;
+        // [15] FileLenH = FileLen / 2: Calculate half file size.
         // Operation: Integer division. Comp: O(1). Flow: FileLen -> FileLenH.
         // Calculation: Divide FileLen by 2. Result is integer floor.
         // Real-world: Find middle point of file size.
@@ -119,25 +144,20 @@ int _tmain(int argc, LPTSTR argv[]) {
         // Function call: ReportSpace(LPCTSTR). Comp: O(disk I/O) inside ReportSpace. Flow: Call -> ReportSpace -> Return.
         // Purpose: Show disk space before file operation.
 
-        hFile = CreateFile(_T("TempTestFile"), GENERIC_READ | GENERIC_WRITE, 0, NULL,
-            CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
-        // [17] CreateFile: Create new file "TempTestFile".
-        // API call: Win32 API. Comp: OS dependent, disk I/O, file system operations. Flow: Call -> hFile.
-        // Params: File name, access mode (read/write), sharing (none), security, creation (new), attributes, template.
-        // Flags: CREATE_NEW: fails if file exists. FILE_ATTRIBUTE_NORMAL: default attributes.
-        // Edge: File already exists? CREATE_NEW fails.
-        // Edge: Disk full? CreateFile fails.
-        // Edge: Permissions issue? CreateFile fails.
-
-        if (hFile == INVALID_HANDLE_VALUE)
-            // [18] if (hFile == INVALID_HANDLE_VALUE): Check for CreateFile failure.
-            // Predicate: hFile == INVALID_HANDLE_VALUE (-1). Comp: O(1) comparison. Flow: hFile -> error handling.
-            // Purpose: Error check after file creation.
-
-            ReportError(_T("Cannot create TempTestFile"), 2, TRUE);
-        // [19] ReportError: Report file creation error and exit.
-        // Function call: ReportError(LPCTSTR, DWORD, BOOL). Comp: O(error handling) inside ReportError. Flow: Call -> ExitProcess.
-        // Params: Error message, exit code 2, exit program TRUE.
+        if (!hFile.Open(_T("TempTestFile"), IO_CREATE_NEW))
+            // [17] hFile.Open: Create new file "TempTestFile", read-write, not shared.
+            // API call: CreateFile (CREATE_NEW) on Win32, open(O_CREAT | O_EXCL) on POSIX.
+            // Comp: OS dependent, disk I/O, file system operations. Flow: Call -> hFile.
+            // Flags: IO_CREATE_NEW: fails if file exists.
+            // Edge: File already exists? Open fails.
+            // Edge: Disk full? Open fails.
+            // Edge: Permissions issue? Open fails.
+            // [18] The bool result replaces the INVALID_HANDLE_VALUE comparison.
+
+            Fatal(_T("Cannot create TempTestFile"), 2);
+        // [19] Fatal: Report file creation error and exit.
+        // Function call: Fatal(LPCTSTR, int). Comp: O(error handling) inside Fatal. Flow: Call -> exit.
+        // Params: Error message, exit code 2.
         // Exit code 2: Indicates file creation failure.
 
         ReportSpace(_T("After file creation"));
@@ -145,82 +165,54 @@ int _tmain(int argc, LPTSTR argv[]) {
         // Function call: ReportSpace(LPCTSTR). Comp: O(disk I/O) inside ReportSpace. Flow: Call -> ReportSpace -> Return.
         // Purpose: Show disk space after file creation, to see change.
 
-        if (!SetFilePointerEx(hFile, FileLen, NULL, FILE_BEGIN))
-            // [21] SetFilePointerEx: Set file pointer to FileLen from beginning.
-            // API call: Win32 API. Comp: OS dependent, file system operation. Flow: hFile, FileLen.
-            // Params: File handle, distance to move (FileLen), output new pointer (NULL), move method (FILE_BEGIN).
-            // Purpose: Prepare to set file size by moving pointer.
-            // Edge: Invalid hFile? SetFilePointerEx fails.
-            // Edge: FileLen is very large? Disk space? SetFilePointerEx might succeed but SetEndOfFile fail.
-
-            ReportError(_T("Cannot set file pointer"), 3, TRUE);
-        // [22] ReportError: Report SetFilePointerEx error and exit.
-        // Function call: ReportError(LPCTSTR, DWORD, BOOL). Comp: O(error handling) inside ReportError. Flow: Call -> ExitProcess.
-        // Params: Error message, exit code 3, exit program TRUE.
-        // Exit code 3: Indicates SetFilePointerEx failure.
-
-        if (!SetEndOfFile(hFile))
-            // [23] SetEndOfFile: Set file end to current file pointer position (FileLen).
-            // API call: Win32 API. Comp: OS dependent, disk allocation, file system operation. Flow: hFile.
-            // Purpose: Allocate space for file up to FileLen.
-            // Edge: Disk full? SetEndOfFile fails.
-            // Edge: Invalid hFile? SetEndOfFile fails.
-            // Edge: Quota limits? SetEndOfFile fails.
-
-            ReportError(_T("Cannot set end of file"), 4, TRUE);
-        // [24] ReportError: Report SetEndOfFile error and exit.
-        // Function call: ReportError(LPCTSTR, DWORD, BOOL). Comp: O(error handling) inside ReportError. Flow: Call -> ExitProcess.
-        // Params: Error message, exit code 4, exit program TRUE.
-        // Exit code 4: Indicates SetEndOfFile failure.
+        if (!IoSetSize(hFile.Get(), (unsigned long long)FileLen))
+            // [21] IoSetSize: Extend the file to FileLen bytes.
+            // API call: SetFilePointerEx + SetEndOfFile on Win32, ftruncate on POSIX.
+            // Comp: OS dependent, file system operation. Flow: hFile, FileLen.
+            // Purpose: Set file size without writing any data. Whether space is
+            // allocated now or only when written (sparse file) is up to the file system.
+            // Edge: Disk full? Quota limits? IoSetSize fails.
+            // [22]-[24] One call and one exit code: the pointer move and the
+            // end-of-file set are no longer separate steps.
+
+            Fatal(_T("Cannot set end of file"), 4);
+        // Exit code 4: Indicates IoSetSize failure. (Exit code 3 was the separate
+        // SetFilePointerEx failure; it is no longer used.)
 
         ReportSpace(_T("After setting file length"));
         // [25] ReportSpace: Report disk space after setting file length.
         // Function call: ReportSpace(LPCTSTR). Comp: O(disk I/O) inside ReportSpace. Flow: Call -> ReportSpace -> Return.
         // Purpose: Show disk space after file size allocation.
 
-        ov.Offset = FileLenH.LowPart;
-        // [26] ov.Offset = FileLenH.LowPart: Set low 32 bits of file offset in OVERLAPPED struct.
-        // Operation: Assignment. Comp: O(1). Flow: FileLenH -> ov.Offset.
-        // Purpose: Specify write offset in file (lower part).
-
-        ov.OffsetHigh = FileLenH.HighPart;
-        // [27] ov.OffsetHigh = FileLenH.HighPart: Set high 32 bits of file offset in OVERLAPPED struct.
-        // Operation: Assignment. Comp: O(1). Flow: FileLenH -> ov.OffsetHigh.
-        // Purpose: Specify write offset in file (higher part).
-        // Note: Together, ov.Offset and ov.OffsetHigh form 64-bit offset.
-
-        if (!WriteFile(hFile, Buffer, sizeof(Buffer), &nWrite, &ov))
-            // [28] WriteFile: Write Buffer to file at offset ov, size sizeof(Buffer).
-            // API call: Win32 API. Comp: OS dependent, disk I/O. Flow: hFile, Buffer, ov -> nWrite.
-            // Params: File handle, buffer, bytes to write (256), bytes written output (nWrite), overlapped struct (ov).
+        if (!IoWriteAt(hFile.Get(), Buffer, sizeof(Buffer), (unsigned long long)FileLenH))
+            // [26]-[28] IoWriteAt: Write Buffer to file at offset FileLenH, size sizeof(Buffer).
+            // API call: WriteFile with the offset in an OVERLAPPED on Win32, pwrite on POSIX.
+            // Comp: OS dependent, disk I/O. Flow: hFile, Buffer, FileLenH.
             // Purpose: Write data to middle of file (at offset FileLenH).
-            // Edge: Invalid hFile? WriteFile fails.
-            // Edge: Disk full? WriteFile might fail or write less than requested.
-            // Edge: Permissions? WriteFile fails.
+            // Edge: Disk full? IoWriteAt fails; a short write is retried, never silently accepted.
+            // Edge: Permissions? IoWriteAt fails.
 
-            ReportError(_T("Cannot write to middle of file"), 5, TRUE);
-        // [29] ReportError: Report WriteFile error and exit.
-        // Function call: ReportError(LPCTSTR, DWORD, BOOL). Comp: O(error handling) inside ReportError. Flow: Call -> ExitProcess.
-        // Params: Error message, exit code 5, exit program TRUE.
-        // Exit code 5: Indicates WriteFile failure.
+            Fatal(_T("Cannot write to middle of file"), 5);
+        // [29] Fatal: Report IoWriteAt error and exit.
+        // Exit code 5: Indicates write failure.
 
         ReportSpace(_T("After writing to middle"));
         // [30] ReportSpace: Report disk space after writing to middle of file.
         // Function call: ReportSpace(LPCTSTR). Comp: O(disk I/O) inside ReportSpace. Flow: Call -> ReportSpace -> Return.
         // Purpose: Show disk space after write operation.
 
-        CloseHandle(hFile);
-        // [31] CloseHandle: Close file handle.
-        // API call: Win32 API. Comp: OS dependent, file system operation, resource release. Flow: hFile.
-        // Purpose: Release file handle and OS resources.
-        // Pitfall: Resource leak if CloseHandle is not called (though RAII handles this in C++ usually, raw handles need manual close).
+        hFile.Close();
+        // [31] hFile.Close: Close file handle now, before the delete below.
+        // API call: CloseHandle on Win32, close on POSIX. Flow: hFile.
+        // Purpose: Release file handle and OS resources. The IoFile destructor
+        // would do the same at scope exit.
 
-        DeleteFile(_T("TempTestFile"));
-        // [32] DeleteFile: Delete the "TempTestFile".
-        // API call: Win32 API. Comp: OS dependent, file system operation. Flow: File deletion.
+        IoDelete(_T("TempTestFile"));
+        // [32] IoDelete: Delete the "TempTestFile".
+        // API call: DeleteFile on Win32, unlink on POSIX. Flow: File deletion.
         // Purpose: Clean up temporary file.
-        // Edge: File not found? DeleteFile might fail (though file was just created).
-        // Edge: Permissions? DeleteFile fails.
+        // Edge: File not found? IoDelete might fail (though file was just created).
+        // Edge: Permissions? IoDelete fails.
 
         _tprintf(_T("\n----------------------------------------\n"));
         // [33] _tprintf: Print separator line to console.
@@ -243,62 +235,23 @@ int _tmain(int argc, LPTSTR argv[]) {
 }
 // [37] }: End of _tmain function block.
 
-void ReportError(LPCTSTR msg, DWORD exitCode, BOOL exitProgram) {
-    // [38] ReportError: Error reporting function.
-    // Params: msg (error message), exitCode, exitProgram (flag).
-    // Range: Program lifecycle during errors. Mem: Stack frame. Comp: O(error handling). Flow: Error call -> error output -> [exit].
-    // Roles: Centralized error reporting.
-
-    LPVOID lpMsgBuf;
-    // [39] lpMsgBuf: Buffer to hold formatted error message from FormatMessage.
-    // Type: LPVOID (void*). Justify: FormatMessage output buffer type.
-    // Mem: Pointer size (4B or 8B). Dynamically allocated by FormatMessage. Flow: FormatMessage -> _tprintf -> LocalFree.
-    // Real-world: String buffer for error text.
-
-    DWORD dw = GetLastError();
-    // [40] GetLastError: Get last error code from Win32 API.
-    // API call: Win32 API. Comp: O(1) (thread-local storage access). Flow: API call -> dw.
-    // Purpose: Retrieve error code set by previous API function failure.
-    // Range: DWORD (0 to 2^32 - 1), specific error codes.
-
-    FormatMessage(
-        FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
-        NULL, dw, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-        (LPTSTR)&lpMsgBuf, 0, NULL);
-    // [41] FormatMessage: Format error message based on error code dw.
-    // API call: Win32 API. Comp: OS dependent, string formatting, message lookup. Flow: dw -> lpMsgBuf.
-    // Flags: FORMAT_MESSAGE_ALLOCATE_BUFFER: allocate buffer for message. FORMAT_MESSAGE_FROM_SYSTEM: get message from system table.
-    // MAKELANGID: Language ID (neutral).
-    // Edge: No message for error code? FormatMessage might return generic message or fail.
-    // Memory allocation: lpMsgBuf is allocated by FormatMessage.
-
-    _tprintf(_T("\nERROR [%d]: %s\n"), dw, (LPCTSTR)lpMsgBuf);
-    // [42] _tprintf: Print formatted error message and error code to console.
-    // Operation: Output to console. Comp: O(log N) number formatting, string length, console I/O. Flow: dw, lpMsgBuf -> Output.
-    // Purpose: Display error information to user.
-    // Format: Error code in [], error message string.
-
-    LocalFree(lpMsgBuf);
-    // [43] LocalFree: Free memory allocated by FormatMessage for lpMsgBuf.
-    // API call: Win32 API. Comp: O(1) (heap deallocation). Flow: lpMsgBuf.
-    // Purpose: Release dynamically allocated memory.
-    // Important: Must free memory allocated by FORMAT_MESSAGE_ALLOCATE_BUFFER.
-
-    if (exitProgram) {
-        // [44] if (exitProgram): Check if program should exit after reporting error.
-        // Predicate: exitProgram is TRUE. Comp: O(1) boolean check. Flow: exitProgram -> ExitProcess.
-        // Purpose: Conditional program termination based on error severity.
-
-        ExitProcess(exitCode);
-        // [45] ExitProcess: Terminate program immediately with exitCode.
-        // API call: Win32 API. Comp: O(1) (process termination). Flow: exitCode -> Program termination.
-        // Purpose: Force program exit after critical error.
-        // Exit code: Propagates error status to OS/parent process.
-
-    }
-    // [46] }: End of if (exitProgram) block.
-}
-// [47] }: End of ReportError function block.
+void Fatal(LPCTSTR msg, int exitCode) {
+    // [38] Fatal: Report the last system error and exit.
+    // Params: msg (error message), exitCode.
+    // Range: Program lifecycle during errors. Mem: Stack frame. Comp: O(error handling). Flow: Error call -> error output -> exit.
+    // Roles: Every failure in this program is fatal, so report and exit are one call.
+
+    IoReportError(msg, IoLastError(), TRUE);
+    // [39]-[43] IoReportError: "ERROR: msg (system text)" on stderr.
+    // Shared with cat.cpp and cipher.cpp (iofile.h): GetLastError + FormatMessage
+    // on Win32, errno + strerror on POSIX.
+    // IoLastError is read first, before anything else can overwrite it.
+
+    exit(exitCode);
+    // [44]-[45] exit: Terminate program with exitCode.
+    // Exit code: Propagates error status to OS/parent process.
+}
+// [47] }: End of Fatal function block.
 
 void ReportSpace(LPCTSTR Message) {
     // [48] ReportSpace: Reports disk space information.
@@ -306,21 +259,13 @@ void ReportSpace(LPCTSTR Message) {
     // Range: Program lifecycle when disk space is reported. Mem: Stack frame. Comp: O(disk I/O). Flow: ReportSpace call -> space output.
     // Roles: Disk space reporting utility.
 
-    ULARGE_INTEGER FreeBytes, TotalBytes, NumFreeBytes;
-    // [49] FreeBytes: Available space to current user.
-    // Type: ULARGE_INTEGER (union, 64-bit unsigned). Justify: Needs to represent large disk space values.
-    // Range: 0 to 2^64 - 1 bytes (max disk space). Mem: 8B. Comp: O(1). Flow: GetDiskFreeSpaceEx -> _tprintf.
-    // Real-world: Disk space user can utilize.
-
-    // [50] TotalBytes: Total disk space.
-    // Type: ULARGE_INTEGER. Justify: Same as FreeBytes.
-    // Range: 0 to 2^64 - 1 bytes. Mem: 8B. Comp: O(1). Flow: GetDiskFreeSpaceEx -> _tprintf.
-    // Real-world: Total capacity of disk volume.
-
-    // [51] NumFreeBytes: Actual free space on disk.
-    // Type: ULARGE_INTEGER. Justify: Same as FreeBytes.
-    // Range: 0 to 2^64 - 1 bytes. Mem: 8B. Comp: O(1). Flow: GetDiskFreeSpaceEx -> _tprintf.
-    // Real-world: Physical free space, might be less than user available due to quotas/permissions.
+    IoSpace Space;
+    // [49]-[51] Space: total, free and avail, 64-bit unsigned each.
+    // Space.avail: Available space to current user.
+    // Space.total: Total disk space.
+    // Space.free: Actual free space on disk, might be more than avail due to quotas/permissions
+    // (or, on POSIX, the blocks reserved for root).
+    // Range: 0 to 2^64 - 1 bytes. Mem: 24B. Comp: O(1). Flow: IoDiskSpace -> _tprintf.
 
     const double GB = 1024.0 * 1024.0 * 1024.0;
     // [52] GB: Constant for Gigabyte conversion (1024^3).
@@ -328,41 +273,2094 @@ void ReportSpace(LPCTSTR Message) {
     // Value: 1073741824.0 (2^30). Mem: 8B. Comp: O(1). Flow: Used in calculations.
     // Calculation: 1GB = 1024MB, 1MB = 1024KB, 1KB = 1024B. 1024 * 1024 * 1024 = 1073741824.
 
-    if (!GetDiskFreeSpaceEx(NULL, &FreeBytes, &TotalBytes, &NumFreeBytes))
-        // [53] GetDiskFreeSpaceEx: Get disk space information for current drive (NULL).
-        // API call: Win32 API. Comp: OS dependent, disk I/O. Flow: API call -> FreeBytes, TotalBytes, NumFreeBytes.
-        // Params: Drive path (NULL=current), FreeBytes, TotalBytes, NumFreeBytes.
-        // Edge: Invalid drive path (NULL usually valid for current). Disk error? GetDiskFreeSpaceEx fails.
-        // Returns: BOOL, TRUE on success, FALSE on failure.
+    if (!IoDiskSpace(NULL, &Space))
+        // [53] IoDiskSpace: Get disk space information for the current directory's volume (NULL).
+        // API call: GetDiskFreeSpaceEx on Win32, statvfs on POSIX. Comp: OS dependent. Flow: API call -> Space.
+        // Edge: Disk error? IoDiskSpace fails.
+        // Returns: bool, true on success, false on failure.
 
-        ReportError(_T("Cannot get free space"), 1, TRUE);
-    // [54] ReportError: Report GetDiskFreeSpaceEx error and exit.
-    // Function call: ReportError(LPCTSTR, DWORD, BOOL). Comp: O(error handling) inside ReportError. Flow: Call -> ExitProcess.
-    // Params: Error message, exit code 1, exit program TRUE.
-    // Exit code 1: Indicates GetDiskFreeSpaceEx failure.
+        Fatal(_T("Cannot get free space"), 1);
+    // [54] Fatal: Report IoDiskSpace error and exit.
+    // Exit code 1: Indicates IoDiskSpace failure.
 
     _tprintf(_T("\n%25s status:\n"), Message);
     // [55] _tprintf: Print status message with prefix.
     // Operation: Output to console. Comp: O(string length), console I/O. Flow: Message -> Output.
     // Format: %25s: right-align string in 25-char width.
 
-    _tprintf(_T("  Total disk space:   %12.2f GB\n"), (double)TotalBytes.QuadPart / GB);
+    _tprintf(_T("  Total disk space:   %12.2f GB\n"), (double)Space.total / GB);
     // [56] _tprintf: Print total disk space in GB.
-    // Operation: Output to console. Comp: O(number formatting, division), console I/O. Flow: TotalBytes, GB -> Output.
-    // Calculation: (double)TotalBytes.QuadPart / GB: Convert bytes to GB. Double cast for floating point division.
+    // Operation: Output to console. Comp: O(number formatting, division), console I/O. Flow: Space.total, GB -> Output.
+    // Calculation: (double)Space.total / GB: Convert bytes to GB. Double cast for floating point division.
     // Format: %12.2f: 12 chars width, 2 decimal places, floating point.
 
-    _tprintf(_T("  Actual free space:  %12.2f GB\n"), (double)NumFreeBytes.QuadPart / GB);
+    _tprintf(_T("  Actual free space:  %12.2f GB\n"), (double)Space.free / GB);
     // [57] _tprintf: Print actual free disk space in GB.
-    // Operation: Output to console. Comp: O(number formatting, division), console I/O. Flow: NumFreeBytes, GB -> Output.
-    // Calculation: (double)NumFreeBytes.QuadPart / GB: Convert bytes to GB.
+    // Operation: Output to console. Comp: O(number formatting, division), console I/O. Flow: Space.free, GB -> Output.
+    // Calculation: (double)Space.free / GB: Convert bytes to GB.
     // Format: %12.2f: 12 chars width, 2 decimal places, floating point.
 
-    _tprintf(_T("  Available to user:  %12.2f GB\n"), (double)FreeBytes.QuadPart / GB);
+    _tprintf(_T("  Available to user:  %12.2f GB\n"), (double)Space.avail / GB);
     // [58] _tprintf: Print available disk space to user in GB.
-    // Operation: Output to console. Comp: O(number formatting, division), console I/O. Flow: FreeBytes, GB -> Output.
-    // Calculation: (double)FreeBytes.QuadPart / GB: Convert bytes to GB.
+    // Operation: Output to console. Comp: O(number formatting, division), console I/O. Flow: Space.avail, GB -> Output.
+    // Calculation: (double)Space.avail / GB: Convert bytes to GB.
     // Format: %12.2f: 12 chars width, 2 decimal places, floating point.
 
 }
-// [59] }: End of ReportSpace function block.
\ No newline at end of file
+// [59] }: End of ReportSpace function block.
+
+// ---------------------------------------------------------------------------
+// Command-line modes. With no arguments the program is the interactive
+// demonstration above; with arguments it runs one scripted mode and exits.
+//
+//   --sweep=SIZES [--strategy=LIST] [--repeat=N] [--csv=FILE] [--dir=DIR]
+//       allocation-strategy sweep, CSV out [61]
+//   --extents=FILE [--fiemap] [--punch-zeros[=MIN]]
+//       data/hole map, physical vs logical size, hole punching [70]
+//   --stress=THREADS [--files=F] [--stride=SIZE] [--extend-to=SIZE]
+//            [--method=write|fallocate|truncate] [--dir=DIR] [--csv=FILE]
+//       concurrent file growth: throughput, latency, fragmentation [80]
+//   --qd=DEPTHS [--pattern=seq|stride|random] [--block=SIZE] [--file-size=SIZE]
+//               [--stride=SIZE] [--ops=N] [--engine=auto|uring|threads|overlapped]
+//               [--buffered] [--dir=DIR] [--csv=FILE]
+//       positioned-write IOPS, bandwidth and latency vs queue depth [90]
+//   --monitor=PATHS [--rate=HZ] [--duration=S] [--window=S] [--csv=FILE] [--bin=FILE]
+//                   [--alert-free=SIZE|PCT%] [--alert-ttf=S]
+//       continuous free-space sampling with threshold and time-to-full alerts [100]
+//   --du=DIR [--threads=N] [--top=N] [--xdev]
+//       parallel tree walk: logical vs allocated size, heaviest directories [110]
+// ---------------------------------------------------------------------------
+
+typedef std::basic_string<TCHAR> TString;
+
+#define SWEEP_ZERO_CHUNK (1 << 20)   // zero-fill write size
+#define SWEEP_MAX_SIZES 4096         // cap on a range expansion
+
+static int RunSweep(const TCHAR* sizeList, const TCHAR* strategyList, int repeat,
+                    const TCHAR* csvPath, const TCHAR* dir);
+static bool ParseSize(const TCHAR* s, const TCHAR** end, unsigned long long* n);
+static int RunExtents(const TCHAR* path, bool fiemap, bool punch, unsigned long long minPunch);
+struct StressConfig;
+static int RunStress(const TCHAR* threadList, const StressConfig& cfg, const TCHAR* csvPath, const TCHAR* dir);
+struct QdConfig;
+static int RunQd(const TCHAR* depthList, const QdConfig& cfg, const TCHAR* csvPath, const TCHAR* dir);
+struct MonitorConfig;
+static int RunMonitor(const TCHAR* pathList, const MonitorConfig& cfg, const TCHAR* csvPath, const TCHAR* binPath);
+static int RunDu(const TCHAR* root, int threads, int top, bool xdev);
+
+// [80a] Stress parameters (defaults: 4 files per thread grown 64 KB at a
+// time to 64 MB each, with real data writes).
+enum StressMethod { STRESS_WRITE, STRESS_FALLOCATE, STRESS_TRUNCATE };
+struct StressConfig {
+    int files;
+    unsigned long long stride, extendTo;
+    StressMethod method;
+};
+
+// [90a] Queue-depth benchmark parameters (defaults: 4 KB random writes over
+// a 256 MB file, O_DIRECT, the best engine available).
+enum QdPattern { QD_SEQ, QD_STRIDE, QD_RANDOM };
+enum QdEngine { QD_AUTO, QD_URING, QD_THREADS, QD_OVERLAPPED };
+struct QdConfig {
+    unsigned long long block, fileSize, stride, ops;
+    QdPattern pattern;
+    QdEngine engine;
+    bool direct;
+};
+
+// [100a] Monitor parameters (defaults: 10 Hz until Ctrl-C, 60 s rate
+// window, no alerts).
+struct MonitorConfig {
+    int rate, duration;
+    double window, alertPct, alertTtf;
+    unsigned long long alertFree;
+};
+
+// [60] RunMode: parse the scripted-mode arguments and run the mode.
+static int RunMode(int argc, LPTSTR argv[]) {
+    const TCHAR *sweep = NULL, *strategy = NULL, *csvPath = NULL, *dir = NULL, *extents = NULL, *stress = NULL;
+    int repeat = 3;
+    bool fiemap = false, punch = false;
+    unsigned long long minPunch = 0;
+    StressConfig sc = { 4, 64 << 10, 64 << 20, STRESS_WRITE };
+    const TCHAR *e, *qd = NULL;
+    QdConfig qc = { 4096, 256 << 20, 0, 0, QD_RANDOM, QD_AUTO, true };
+    const TCHAR *monitor = NULL, *binPath = NULL;
+    MonitorConfig mc = { 10, 0, 60, 0, 0, 0 };
+    const TCHAR* du = NULL;
+    int duThreads = (int)std::thread::hardware_concurrency(), duTop = 20;
+    bool xdev = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (_tcsncmp(argv[i], _T("--sweep="), 8) == 0) sweep = argv[i] + 8;
+        else if (_tcsncmp(argv[i], _T("--strategy="), 11) == 0) strategy = argv[i] + 11;
+        else if (_tcsncmp(argv[i], _T("--repeat="), 9) == 0) repeat = _ttoi(argv[i] + 9);
+        else if (_tcsncmp(argv[i], _T("--csv="), 6) == 0) csvPath = argv[i] + 6;
+        else if (_tcsncmp(argv[i], _T("--dir="), 6) == 0) dir = argv[i] + 6;
+        else if (_tcsncmp(argv[i], _T("--extents="), 10) == 0) extents = argv[i] + 10;
+        else if (_tcscmp(argv[i], _T("--fiemap")) == 0) fiemap = true;
+        else if (_tcscmp(argv[i], _T("--punch-zeros")) == 0) punch = true;
+        else if (_tcsncmp(argv[i], _T("--punch-zeros="), 14) == 0) {
+            punch = true;
+            if (!ParseSize(argv[i] + 14, &e, &minPunch) || *e) minPunch = 0;
+        }
+        else if (_tcsncmp(argv[i], _T("--stress="), 9) == 0) stress = argv[i] + 9;
+        else if (_tcsncmp(argv[i], _T("--files="), 8) == 0) sc.files = _ttoi(argv[i] + 8);
+        else if (_tcsncmp(argv[i], _T("--stride="), 9) == 0 && ParseSize(argv[i] + 9, &e, &sc.stride) && !*e) {}
+        else if (_tcsncmp(argv[i], _T("--extend-to="), 12) == 0 && ParseSize(argv[i] + 12, &e, &sc.extendTo) && !*e) {}
+        else if (_tcscmp(argv[i], _T("--method=write")) == 0) sc.method = STRESS_WRITE;
+        else if (_tcscmp(argv[i], _T("--method=fallocate")) == 0) sc.method = STRESS_FALLOCATE;
+        else if (_tcscmp(argv[i], _T("--method=truncate")) == 0) sc.method = STRESS_TRUNCATE;
+        else if (_tcsncmp(argv[i], _T("--qd="), 5) == 0) qd = argv[i] + 5;
+        else if (_tcscmp(argv[i], _T("--pattern=seq")) == 0) qc.pattern = QD_SEQ;
+        else if (_tcscmp(argv[i], _T("--pattern=stride")) == 0) qc.pattern = QD_STRIDE;
+        else if (_tcscmp(argv[i], _T("--pattern=random")) == 0) qc.pattern = QD_RANDOM;
+        else if (_tcsncmp(argv[i], _T("--block="), 8) == 0 && ParseSize(argv[i] + 8, &e, &qc.block) && !*e) {}
+        else if (_tcsncmp(argv[i], _T("--file-size="), 12) == 0 && ParseSize(argv[i] + 12, &e, &qc.fileSize) && !*e) {}
+        else if (_tcsncmp(argv[i], _T("--ops="), 6) == 0 && ParseSize(argv[i] + 6, &e, &qc.ops) && !*e) {}
+        else if (_tcscmp(argv[i], _T("--engine=auto")) == 0) qc.engine = QD_AUTO;
+        else if (_tcscmp(argv[i], _T("--engine=uring")) == 0) qc.engine = QD_URING;
+        else if (_tcscmp(argv[i], _T("--engine=threads")) == 0) qc.engine = QD_THREADS;
+        else if (_tcscmp(argv[i], _T("--engine=overlapped")) == 0) qc.engine = QD_OVERLAPPED;
+        else if (_tcscmp(argv[i], _T("--buffered")) == 0) qc.direct = false;
+        else if (_tcsncmp(argv[i], _T("--du="), 5) == 0) du = argv[i] + 5;
+        else if (_tcsncmp(argv[i], _T("--threads="), 10) == 0) duThreads = _ttoi(argv[i] + 10);
+        else if (_tcsncmp(argv[i], _T("--top="), 6) == 0) duTop = _ttoi(argv[i] + 6);
+        else if (_tcscmp(argv[i], _T("--xdev")) == 0) xdev = true;
+        else if (_tcsncmp(argv[i], _T("--monitor="), 10) == 0) monitor = argv[i] + 10;
+        else if (_tcsncmp(argv[i], _T("--rate="), 7) == 0) mc.rate = _ttoi(argv[i] + 7);
+        else if (_tcsncmp(argv[i], _T("--duration="), 11) == 0) mc.duration = _ttoi(argv[i] + 11);
+        else if (_tcsncmp(argv[i], _T("--window="), 9) == 0) mc.window = _ttoi(argv[i] + 9);
+        else if (_tcsncmp(argv[i], _T("--bin="), 6) == 0) binPath = argv[i] + 6;
+        else if (_tcsncmp(argv[i], _T("--alert-ttf="), 12) == 0) mc.alertTtf = _ttoi(argv[i] + 12);
+        else if (_tcsncmp(argv[i], _T("--alert-free="), 13) == 0 && ParseSize(argv[i] + 13, &e, &mc.alertFree)
+                 && (!*e || (*e == _T('%') && !e[1]))) {
+            if (*e) {                           // PCT%: ParseSize read the digits as a plain number
+                mc.alertPct = (double)mc.alertFree;
+                mc.alertFree = 0;
+            }
+        }
+        else {
+            _ftprintf(stderr, _T("Usage: freespace [--sweep=SIZES [--strategy=LIST] [--repeat=N] [--csv=FILE] [--dir=DIR]]\n")
+                              _T("                 [--extents=FILE [--fiemap] [--punch-zeros[=MIN]]]\n")
+                              _T("                 [--stress=THREADS [--files=F] [--stride=SIZE] [--extend-to=SIZE]\n")
+                              _T("                                   [--method=write|fallocate|truncate] [--dir=DIR] [--csv=FILE]]\n")
+                              _T("                 [--qd=DEPTHS [--pattern=seq|stride|random] [--block=SIZE] [--file-size=SIZE]\n")
+                              _T("                              [--stride=SIZE] [--ops=N] [--engine=auto|uring|threads|overlapped]\n")
+                              _T("                              [--buffered] [--dir=DIR] [--csv=FILE]]\n")
+                              _T("                 [--monitor=PATHS [--rate=HZ] [--duration=S] [--window=S] [--csv=FILE] [--bin=FILE]\n")
+                              _T("                                  [--alert-free=SIZE|PCT%%] [--alert-ttf=S]]\n")
+                              _T("                 [--du=DIR [--threads=N] [--top=N] [--xdev]]\n"));
+            return 1;
+        }
+    }
+    if (repeat < 1) repeat = 1;
+
+    if (sweep != NULL) return RunSweep(sweep, strategy, repeat, csvPath, dir);
+    if (extents != NULL) return RunExtents(extents, fiemap, punch, minPunch);
+    if (stress != NULL) {
+        if (sc.files < 1 || sc.stride == 0 || sc.extendTo < sc.stride) {
+            IoReportError(_T("Bad --stress parameters (need --files >= 1 and 0 < --stride <= --extend-to)"), 0, FALSE);
+            return 1;
+        }
+        return RunStress(stress, sc, csvPath, dir);
+    }
+    if (qd != NULL) {
+        qc.stride = sc.stride;                  // --stride: distance between writes for --pattern=stride
+        if (qc.block == 0 || qc.fileSize < qc.block || qc.stride < qc.block) {
+            IoReportError(_T("Bad --qd parameters (need 0 < --block <= --file-size and --stride >= --block)"), 0, FALSE);
+            return 1;
+        }
+        return RunQd(qd, qc, csvPath, dir);
+    }
+    if (monitor != NULL) {
+        if (mc.rate < 1 || mc.rate > 1000 || mc.duration < 0 || mc.window <= 0 || mc.alertPct > 100) {
+            IoReportError(_T("Bad --monitor parameters (need 1 <= --rate <= 1000, --window >= 1, --alert-free PCT <= 100)"),
+                          0, FALSE);
+            return 1;
+        }
+        return RunMonitor(monitor, mc, csvPath, binPath);
+    }
+    if (du != NULL) {
+        if (duThreads < 1) duThreads = 1;
+        if (duThreads > 1024 || duTop < 0) {
+            IoReportError(_T("Bad --du parameters (need --threads <= 1024 and --top >= 0)"), 0, FALSE);
+            return 1;
+        }
+        return RunDu(du, duThreads, duTop, xdev);
+    }
+    _ftprintf(stderr, _T("No mode given (--sweep=SIZES, --extents=FILE, --stress=THREADS, --qd=DEPTHS, --monitor=PATHS\n")
+                      _T("or --du=DIR)\n"));
+    return 1;
+}
+
+// [61] Sweep: for every size and allocation strategy, create a fresh file,
+// allocate it, flush it, and record what that cost and what it bought.
+// The question it answers: which way to preallocate a write-ahead file.
+//   truncate        ftruncate / SetEndOfFile. Sparse: no blocks, so the
+//                   first write to each block still has to allocate one.
+//   fallocate       fallocate(2) mode 0 (Win32: FileAllocationInfo).
+//                   Reserves blocks as unwritten extents and does not write data.
+//   posix_fallocate glibc falls back to writing one byte per block where
+//                   the filesystem lacks fallocate. POSIX only.
+//   zero            Write zeros. Every block is written, so it costs the
+//                   most, but the first overwrite needs no extent change.
+// Sizes: comma list of SIZE or LO..HI (doubling), LO..HI*F (times F),
+// LO..HI+STEP (linear); SIZE takes K/M/G/T suffixes (powers of 1024).
+//
+// One CSV row per trial:
+//   strategy,size,rep,alloc_us,sync_us,file_size,blocks,alloc_bytes,free_delta,status
+// alloc_us is the allocation call(s) alone; sync_us the IoSyncData after it
+// (for zero-fill most of the cost moves there). blocks is st_blocks (512 B
+// units), alloc_bytes the same in bytes. free_delta is volume free space
+// before minus after, sampled after the sync; other writers on the same
+// volume show up in it, so use --repeat and look at the spread. status is
+// "ok" or "err=N" with the system error code.
+
+static long long NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// [62] ParseSize: digits plus optional K/M/G/T; *end is left after the suffix.
+// Returns false when there are no digits.
+static bool ParseSize(const TCHAR* s, const TCHAR** end, unsigned long long* n) {
+    const TCHAR* p = s;
+    unsigned long long v = 0;
+    for (; *p >= _T('0') && *p <= _T('9'); p++) v = v * 10 + (unsigned long long)(*p - _T('0'));
+    if (p == s) return false;
+    switch (*p) {
+    case _T('k'): case _T('K'): v <<= 10; p++; break;
+    case _T('m'): case _T('M'): v <<= 20; p++; break;
+    case _T('g'): case _T('G'): v <<= 30; p++; break;
+    case _T('t'): case _T('T'): v <<= 40; p++; break;
+    default: break;
+    }
+    *end = p;
+    *n = v;
+    return true;
+}
+
+// [63] ParseSizeList: expand "4K,1M..64M,1G..4G+1G" into sizes, in order.
+static bool ParseSizeList(const TCHAR* s, std::vector<unsigned long long>* sizes) {
+    while (*s) {
+        unsigned long long lo, hi, step = 2;
+        bool linear = false;
+        if (!ParseSize(s, &s, &lo)) return false;
+        hi = lo;
+        if (s[0] == _T('.') && s[1] == _T('.')) {
+            if (!ParseSize(s + 2, &s, &hi) || hi < lo) return false;
+            if (*s == _T('*') || *s == _T('+')) {
+                linear = *s == _T('+');
+                if (!ParseSize(s + 1, &s, &step)) return false;
+            }
+            if (step == 0 || (!linear && step < 2) || (!linear && lo == 0)) return false;
+        }
+        for (unsigned long long v = lo; v <= hi; v = linear ? v + step : v * step) {
+            if (sizes->size() >= SWEEP_MAX_SIZES) return false;
+            sizes->push_back(v);
+            if (hi - v < (linear ? step : v * (step - 1))) break;    // next one would pass hi (or wrap)
+        }
+        if (*s == _T(',')) s++;
+        else if (*s) return false;
+    }
+    return !sizes->empty();
+}
+
+// [64] Strategies. Each allocates size bytes in a new, empty file and
+// leaves the error code set on failure. NULL: not available on this platform.
+typedef bool (*AllocFn)(HANDLE h, unsigned long long size);
+
+static bool AllocTruncate(HANDLE h, unsigned long long size) {
+    return IoSetSize(h, size);
+}
+
+#if defined(_WIN32)
+static bool AllocFallocate(HANDLE h, unsigned long long size) {
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = (LONGLONG)size;
+    return SetFileInformationByHandle(h, FileAllocationInfo, &info, sizeof(info)) && IoSetSize(h, size);
+}
+#elif defined(__linux__)
+static bool AllocFallocate(HANDLE h, unsigned long long size) {
+    return size == 0 || fallocate(h, 0, 0, (off_t)size) == 0;
+}
+#else
+#define AllocFallocate NULL
+#endif
+
+#ifndef _WIN32
+static bool AllocPosixFallocate(HANDLE h, unsigned long long size) {
+    if (size == 0) return true;
+    int r = posix_fallocate(h, 0, (off_t)size);    // returns the error instead of setting errno
+    if (r != 0) errno = r;
+    return r == 0;
+}
+#else
+#define AllocPosixFallocate NULL
+#endif
+
+static bool AllocZero(HANDLE h, unsigned long long size) {
+    static std::vector<BYTE> zeros(SWEEP_ZERO_CHUNK, 0);
+    while (size > 0) {
+        size_t n = size < zeros.size() ? (size_t)size : zeros.size();
+        if (!IoWrite(h, &zeros[0], n)) return false;
+        size -= n;
+    }
+    return true;
+}
+
+struct AllocStrategy {
+    const TCHAR* name;
+    AllocFn fn;
+};
+
+static const AllocStrategy allocStrategies[] = {
+    { _T("truncate"), AllocTruncate },
+    { _T("fallocate"), AllocFallocate },
+    { _T("posix_fallocate"), AllocPosixFallocate },
+    { _T("zero"), AllocZero },
+};
+#define N_STRATEGIES (int)(sizeof(allocStrategies) / sizeof(allocStrategies[0]))
+
+// [65] ParseStrategies: comma list of names, or every available one for NULL.
+static bool ParseStrategies(const TCHAR* s, std::vector<const AllocStrategy*>* out) {
+    if (s == NULL) {
+        for (int i = 0; i < N_STRATEGIES; i++)
+            if (allocStrategies[i].fn != NULL) out->push_back(&allocStrategies[i]);
+        return true;
+    }
+    while (*s) {
+        const TCHAR* e = s;
+        while (*e && *e != _T(',')) e++;
+        int i = 0;
+        for (; i < N_STRATEGIES; i++) {
+            const TCHAR* name = allocStrategies[i].name;
+            size_t len = 0;
+            while (name[len]) len++;
+            if (len == (size_t)(e - s) && _tcsncmp(s, name, len) == 0) break;
+        }
+        if (i == N_STRATEGIES || allocStrategies[i].fn == NULL) return false;
+        out->push_back(&allocStrategies[i]);
+        s = *e ? e + 1 : e;
+    }
+    return !out->empty();
+}
+
+// [66] SweepTrial: one row. The file is always closed and deleted before
+// returning, whatever failed, so a sweep never leaves TempTestFile behind.
+static bool SweepTrial(FILE* csv, const TString& dir, const TString& path, const AllocStrategy* st,
+                       unsigned long long size, int rep) {
+    IoSpace before, after;
+    unsigned long long fileSize = 0, allocBytes = 0;
+    long long tAlloc = 0, tSync = 0;
+    IoError err = 0;
+    IoFile hFile;
+
+    if (!IoDiskSpace(dir.c_str(), &before) || !hFile.Open(path.c_str(), IO_CREATE_NEW)) {
+        IoReportError(_T("Cannot create the sweep file"), IoLastError(), TRUE);
+        return false;
+    }
+
+    long long t0 = NowNs();
+    bool ok = st->fn(hFile.Get(), size);
+    long long t1 = NowNs();
+    if (ok) ok = IoSyncData(hFile.Get());
+    long long t2 = NowNs();
+    if (!ok) err = IoLastError();
+    tAlloc = t1 - t0;
+    tSync = t2 - t1;
+
+    IoSize(hFile.Get(), &fileSize);
+    IoAllocatedSize(hFile.Get(), &allocBytes);
+    if (!IoDiskSpace(dir.c_str(), &after)) after = before;
+    hFile.Close();
+    IoDelete(path.c_str());
+
+    char status[32];
+    if (ok) snprintf(status, sizeof(status), "ok");
+    else snprintf(status, sizeof(status), "err=%lu", (unsigned long)err);
+#if defined(_WIN32) && defined(_UNICODE)
+    fprintf(csv, "%ls", st->name);
+#else
+    fprintf(csv, "%s", st->name);
+#endif
+    fprintf(csv, ",%llu,%d,%.1f,%.1f,%llu,%llu,%llu,%lld,%s\n", size, rep, tAlloc / 1e3, tSync / 1e3,
+            fileSize, allocBytes / 512, allocBytes, (long long)(before.free - after.free), status);
+    fflush(csv);
+    return true;
+}
+
+static int RunSweep(const TCHAR* sizeList, const TCHAR* strategyList, int repeat,
+                    const TCHAR* csvPath, const TCHAR* dir) {
+    std::vector<unsigned long long> sizes;
+    std::vector<const AllocStrategy*> strategies;
+
+    if (!ParseSizeList(sizeList, &sizes)) {
+        IoReportError(_T("Bad --sweep size list (e.g. 4K,1M..1G or 1G..8G+1G)"), 0, FALSE);
+        return 1;
+    }
+    if (!ParseStrategies(strategyList, &strategies)) {
+        IoReportError(_T("Bad --strategy (truncate, fallocate, posix_fallocate, zero; not all exist everywhere)"), 0, FALSE);
+        return 1;
+    }
+
+    FILE* csv = stdout;
+    if (csvPath != NULL && (csv = _tfopen(csvPath, _T("w"))) == NULL) {
+        IoReportError(_T("Cannot create the CSV file"), IoLastError(), TRUE);
+        return 1;
+    }
+
+    // [67] TempTestFile.sweep in --dir: the same O_EXCL create as the
+    // interactive mode, so a stray file from elsewhere is never overwritten.
+    TString d(dir != NULL ? dir : _T("."));
+    TString path = d + _T("/TempTestFile.sweep");
+
+    fprintf(csv, "strategy,size,rep,alloc_us,sync_us,file_size,blocks,alloc_bytes,free_delta,status\n");
+    int rc = 0;
+    for (size_t i = 0; i < sizes.size() && rc == 0; i++)
+        for (size_t j = 0; j < strategies.size() && rc == 0; j++)
+            for (int rep = 0; rep < repeat && rc == 0; rep++)
+                if (!SweepTrial(csv, d, path, strategies[j], sizes[i], rep)) rc = 2;
+
+    if (csv != stdout) fclose(csv);
+    return rc;
+}
+
+// [70] Extents: where a file's data really is. The listing walks the file
+// one boundary at a time with SEEK_DATA/SEEK_HOLE (Win32:
+// FSCTL_QUERY_ALLOCATED_RANGES), so its cost follows the number of extents,
+// not the size: a multi-TB sparse image with a few extents lists instantly.
+// --fiemap adds the physical layout from FS_IOC_FIEMAP (Linux only).
+// --punch-zeros reads every data range and deallocates runs of all-zero
+// blocks of at least MIN bytes (default: one block) with
+// FALLOC_FL_PUNCH_HOLE (Win32: FSCTL_SET_ZERO_DATA on a sparse file). Reads
+// see the same zeros afterwards; only the allocation changes. Its cost
+// follows the amount of data, since holes are skipped.
+
+#define EXTENT_READ_CHUNK (1 << 20)   // --punch-zeros read size
+#define FIEMAP_BATCH 128              // extents per FS_IOC_FIEMAP call
+
+// [71] NextData: the first data range at or after off, as [*start, *end).
+// Returns 1 for a range, 0 when only hole (or nothing) is left, -1 on error.
+// Filesystems without SEEK_DATA support report the whole file as data.
+static int NextData(HANDLE h, unsigned long long off, unsigned long long size,
+                    unsigned long long* start, unsigned long long* end) {
+    if (off >= size) return 0;
+#if defined(_WIN32)
+    FILE_ALLOCATED_RANGE_BUFFER q, r;
+    DWORD got = 0;
+    q.FileOffset.QuadPart = (LONGLONG)off;
+    q.Length.QuadPart = (LONGLONG)(size - off);
+    if (!DeviceIoControl(h, FSCTL_QUERY_ALLOCATED_RANGES, &q, sizeof(q), &r, sizeof(r), &got, NULL)
+        && GetLastError() != ERROR_MORE_DATA) return -1;
+    if (got < sizeof(r)) return 0;
+    *start = (unsigned long long)r.FileOffset.QuadPart;
+    *end = *start + (unsigned long long)r.Length.QuadPart;
+#elif defined(SEEK_DATA)
+    off_t d = lseek(h, (off_t)off, SEEK_DATA);
+    if (d < 0) return errno == ENXIO ? 0 : -1;
+    off_t e = lseek(h, d, SEEK_HOLE);
+    if (e < 0) return -1;
+    *start = (unsigned long long)d;
+    *end = (unsigned long long)e;
+#else
+    *start = off;
+    *end = size;
+#endif
+    if (*end > size) *end = size;
+    return 1;
+}
+
+// [72] Fiemap: physical extents of the file. With print set, one table row
+// per extent on stdout; always returns the extent count, -1 on error (or
+// where FIEMAP does not exist). FIEMAP_FLAG_SYNC flushes delayed
+// allocations first, so freshly written data has real addresses.
+static long Fiemap(HANDLE h, bool print) {
+#ifdef __linux__
+    std::vector<char> mem(sizeof(struct fiemap) + FIEMAP_BATCH * sizeof(struct fiemap_extent));
+    struct fiemap* fm = (struct fiemap*)&mem[0];
+    unsigned long long next = 0;
+    long count = 0;
+
+    if (!print) {                               // count only: no extent array needed
+        memset(fm, 0, sizeof(*fm));
+        fm->fm_length = FIEMAP_MAX_OFFSET;
+        fm->fm_flags = FIEMAP_FLAG_SYNC;
+        if (ioctl(h, FS_IOC_FIEMAP, fm) != 0) return -1;
+        return (long)fm->fm_mapped_extents;
+    }
+    _tprintf(_T("  %5s %18s %18s %14s  %s\n"), _T("#"), _T("logical"), _T("physical"), _T("length"), _T("flags"));
+    for (;;) {
+        memset(fm, 0, sizeof(*fm));
+        fm->fm_start = next;
+        fm->fm_length = FIEMAP_MAX_OFFSET - next;
+        fm->fm_flags = FIEMAP_FLAG_SYNC;
+        fm->fm_extent_count = FIEMAP_BATCH;
+        if (ioctl(h, FS_IOC_FIEMAP, fm) != 0) return -1;
+        if (fm->fm_mapped_extents == 0) break;
+        bool last = false;
+        for (unsigned int i = 0; i < fm->fm_mapped_extents; i++) {
+            const struct fiemap_extent* fe = &fm->fm_extents[i];
+            _tprintf(_T("  %5ld %18llu %18llu %14llu "), count++, (unsigned long long)fe->fe_logical,
+                     (unsigned long long)fe->fe_physical, (unsigned long long)fe->fe_length);
+            if (fe->fe_flags & FIEMAP_EXTENT_UNWRITTEN) _tprintf(_T(" unwritten"));
+            if (fe->fe_flags & FIEMAP_EXTENT_DELALLOC) _tprintf(_T(" delalloc"));
+            if (fe->fe_flags & FIEMAP_EXTENT_ENCODED) _tprintf(_T(" encoded"));
+            if (fe->fe_flags & FIEMAP_EXTENT_SHARED) _tprintf(_T(" shared"));
+            if (fe->fe_flags & FIEMAP_EXTENT_DATA_INLINE) _tprintf(_T(" inline"));
+            if (fe->fe_flags & FIEMAP_EXTENT_LAST) _tprintf(_T(" last"));
+            _tprintf(_T("\n"));
+            last = (fe->fe_flags & FIEMAP_EXTENT_LAST) != 0;
+            next = fe->fe_logical + fe->fe_length;
+        }
+        if (last) break;
+    }
+    return count;
+#else
+    (void)h; (void)print;
+    return -1;
+#endif
+}
+
+// [73] PunchHole: deallocate [off, off + len) without changing the size.
+static bool PunchHole(HANDLE h, unsigned long long off, unsigned long long len) {
+#if defined(_WIN32)
+    FILE_ZERO_DATA_INFORMATION z;
+    DWORD got;
+    z.FileOffset.QuadPart = (LONGLONG)off;
+    z.BeyondFinalZero.QuadPart = (LONGLONG)(off + len);
+    return DeviceIoControl(h, FSCTL_SET_ZERO_DATA, &z, sizeof(z), NULL, 0, &got, NULL) != 0;
+#elif defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+    return fallocate(h, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)off, (off_t)len) == 0;
+#else
+    (void)h; (void)off; (void)len;
+    errno = EOPNOTSUPP;
+    return false;
+#endif
+}
+
+static bool IsZero(const BYTE* p, size_t n) {
+    return n == 0 || (p[0] == 0 && memcmp(p, p + 1, n - 1) == 0);    // memcmp is the vectorized loop
+}
+
+// [74] PunchZeros: scan each data range in whole blocks, collecting runs
+// of zero blocks; runs of at least minRun bytes are punched. Partial
+// blocks (an unaligned range start or end) are left alone: punching them
+// zeroes bytes but frees nothing.
+static bool PunchZeros(HANDLE h, unsigned long long size, unsigned long long block, unsigned long long minRun,
+                       unsigned long long* punched, unsigned long long* runs) {
+    std::vector<BYTE> buf((size_t)std::max(block, EXTENT_READ_CHUNK / block * block)); // At least one block.
+    unsigned long long off = 0, start, end;
+    int r;
+
+    *punched = *runs = 0;
+    while ((r = NextData(h, off, size, &start, &end)) > 0) {
+        unsigned long long pos = (start + block - 1) / block * block;
+        unsigned long long stop = end / block * block;
+        unsigned long long runStart = pos, runLen = 0;
+
+        while (pos < stop) {
+            size_t want = (size_t)(stop - pos < buf.size() ? stop - pos : buf.size()), got;
+            if (!IoReadAt(h, &buf[0], want, pos, &got) || got < want) return false;
+            for (size_t i = 0; i < want; i += (size_t)block, pos += block) {
+                if (IsZero(&buf[i], (size_t)block)) {
+                    if (runLen == 0) runStart = pos;
+                    runLen += block;
+                    continue;
+                }
+                if (runLen >= minRun && runLen > 0) {
+                    if (!PunchHole(h, runStart, runLen)) return false;
+                    *punched += runLen;
+                    ++*runs;
+                }
+                runLen = 0;
+            }
+        }
+        if (runLen >= minRun && runLen > 0) {
+            if (!PunchHole(h, runStart, runLen)) return false;
+            *punched += runLen;
+            ++*runs;
+        }
+        off = end;
+    }
+    return r == 0;
+}
+
+static int RunExtents(const TCHAR* path, bool fiemap, bool punch, unsigned long long minPunch) {
+    IoFile hFile;
+    unsigned long long size = 0, allocated = 0, block = 4096;
+
+    if (!hFile.Open(path, punch ? IO_UPDATE : IO_READ) || !IoSize(hFile.Get(), &size)) {
+        IoReportError(_T("Cannot open the file (a regular file is required)"), IoLastError(), TRUE);
+        return 2;
+    }
+    HANDLE h = hFile.Get();
+#ifdef _WIN32
+    block = 64 << 10;                   // NTFS deallocates sparse ranges in 64 KB units
+    if (punch) {
+        DWORD got;
+        if (!DeviceIoControl(h, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &got, NULL)) {
+            IoReportError(_T("Cannot mark the file sparse"), IoLastError(), TRUE);
+            return 2;
+        }
+    }
+#else
+    // The allocation unit, not st_blksize: that is only the preferred I/O
+    // size, and NFS, Lustre and CephFS report several MB there.
+    struct statvfs vfs;
+#ifdef FIGETBSZ
+    int fsBlock = 0;
+    if (ioctl(h, FIGETBSZ, &fsBlock) == 0 && fsBlock > 0) block = (unsigned long long)fsBlock;
+    else
+#endif
+    if (fstatvfs(h, &vfs) == 0 && vfs.f_bsize > 0) block = (unsigned long long)vfs.f_bsize;
+#endif
+    IoAllocatedSize(h, &allocated);
+
+    // [75] The map: alternating data and hole lines, then the totals.
+    _tprintf(_T("File: %s\n\n"), path);
+    _tprintf(_T("  %-5s %18s %18s %18s\n"), _T(""), _T("start"), _T("end"), _T("length"));
+    unsigned long long off = 0, start, end, dataBytes = 0, nData = 0, nHoles = 0;
+    int r;
+    while ((r = NextData(h, off, size, &start, &end)) > 0) {
+        if (start > off) {
+            _tprintf(_T("  %-5s %18llu %18llu %18llu\n"), _T("hole"), off, start, start - off);
+            nHoles++;
+        }
+        _tprintf(_T("  %-5s %18llu %18llu %18llu\n"), _T("data"), start, end, end - start);
+        dataBytes += end - start;
+        nData++;
+        off = end;
+    }
+    if (r < 0) {
+        IoReportError(_T("Cannot enumerate data ranges"), IoLastError(), TRUE);
+        return 3;
+    }
+    if (off < size) {
+        _tprintf(_T("  %-5s %18llu %18llu %18llu\n"), _T("hole"), off, size, size - off);
+        nHoles++;
+    }
+
+    _tprintf(_T("\n  Logical size:   %20llu bytes\n"), size);
+    _tprintf(_T("  Physical size:  %20llu bytes (%.1f%% of logical)\n"), allocated,
+             size > 0 ? 100.0 * (double)allocated / (double)size : 0.0);
+    _tprintf(_T("  Data ranges:    %20llu (%llu bytes)\n"), nData, dataBytes);
+    _tprintf(_T("  Holes:          %20llu (%llu bytes)\n"), nHoles, size - dataBytes);
+
+    if (fiemap) {
+        _tprintf(_T("\nPhysical extents (FIEMAP):\n"));
+        long n = Fiemap(h, true);
+        if (n < 0) IoReportError(_T("FIEMAP failed or is not available"), IoLastError(), TRUE);
+        else _tprintf(_T("  %ld extents\n"), n);
+    }
+
+    if (punch) {
+        unsigned long long punched, runs, after = allocated;
+        if (minPunch < block) minPunch = block;
+        if (!PunchZeros(h, size, block, minPunch, &punched, &runs)) {
+            IoReportError(_T("Punching zero ranges failed"), IoLastError(), TRUE);
+            return 4;
+        }
+        IoSyncData(h);
+        IoAllocatedSize(h, &after);
+        _tprintf(_T("\n  Punched:        %20llu bytes in %llu runs of >= %llu bytes\n"), punched, runs, minPunch);
+        _tprintf(_T("  Physical size:  %20llu bytes now (%lld reclaimed)\n"), after, (long long)(allocated - after));
+    }
+    return 0;
+}
+
+// [80] Stress: N threads grow their own files at the same time, which is
+// what the allocator sees under a multi-writer ingest load. Each thread
+// creates --files files and extends them round-robin, --stride bytes per
+// step, until each reaches --extend-to. Round-robin is deliberate: a
+// thread's own files interleave as well as the threads' files. Each step is
+// timed:
+//   write      pwrite of real data. On delayed-allocation filesystems
+//              (ext4, xfs) blocks are chosen at writeback, so the
+//              extent count shows what writeback made of the interleaving.
+//   fallocate  fallocate(2) of the new range, so blocks are chosen during
+//              the call itself.
+//   truncate   size-only growth, the baseline with no allocation at all.
+// THREADS takes the same list/range syntax as --sweep sizes (1..16 = 1, 2,
+// 4, 8, 16), so one run shows how things scale. Per level: aggregate MB/s
+// and steps/s over the growth phase, p50/p99 step latency for each thread,
+// and physical extents per file (FIEMAP, Linux).
+
+#define STRESS_DATA_CHUNK (1 << 20)
+
+static std::atomic<bool> stressStop(false);
+
+static void StressInterrupt(int) {
+    stressStop = true;
+}
+
+static TString Num(unsigned long long v) {
+    TCHAR digits[24];
+    int i = 24;
+    do digits[--i] = (TCHAR)(_T('0') + v % 10); while ((v /= 10) != 0);
+    return TString(digits + i, digits + 24);
+}
+
+// [81] StressFiles: owns every file a thread created. A path is recorded
+// only after its O_EXCL create succeeded, so nothing that was already there
+// is ever deleted, and the destructor closes and deletes the rest on every
+// way out: normal end, I/O error, or Ctrl-C (which only sets stressStop;
+// threads check it between steps and unwind). Fatal's exit() would skip
+// all of that, which is why these modes return errors instead.
+class StressFiles {
+public:
+    explicit StressFiles(int n) : files(new IoFile[n]), count(0) {}
+    ~StressFiles() {
+        for (int i = 0; i < count; i++) {
+            files[i].Close();
+            IoDelete(paths[i].c_str());
+        }
+    }
+
+    bool Create(const TString& path) {
+        if (!files[count].Open(path.c_str(), IO_CREATE_NEW)) return false;
+        paths.push_back(path);
+        count++;
+        return true;
+    }
+
+    HANDLE Get(int i) const { return files[i].Get(); }
+    int Count() const { return count; }
+
+private:
+    StressFiles(const StressFiles&);
+    StressFiles& operator=(const StressFiles&);
+
+    std::unique_ptr<IoFile[]> files;
+    std::vector<TString> paths;
+    int count;
+};
+
+struct StressResult {
+    std::vector<long long> lat;     // ns per growth step
+    std::vector<long> extents;      // per file, -1 where FIEMAP is unavailable
+    unsigned long long bytes;
+    long long tEnd;                 // end of this thread's growth phase
+    IoError err;                    // first failure, 0 if none
+    LPCTSTR what;
+};
+
+static bool StressExtend(HANDLE h, StressMethod m, unsigned long long cur, unsigned long long n) {
+    static std::vector<BYTE> data(STRESS_DATA_CHUNK, 0xA5);
+    switch (m) {
+    case STRESS_WRITE:
+        while (n > 0) {
+            size_t k = n < data.size() ? (size_t)n : data.size();
+            if (!IoWriteAt(h, &data[0], k, cur)) return false;
+            cur += k;
+            n -= k;
+        }
+        return true;
+    case STRESS_FALLOCATE:
+#if defined(__linux__)
+        return fallocate(h, 0, (off_t)cur, (off_t)n) == 0;
+#elif defined(_WIN32)
+        return AllocFallocate(h, cur + n);
+#else
+        return AllocPosixFallocate(h, cur + n);
+#endif
+    case STRESS_TRUNCATE:
+        return IoSetSize(h, cur + n);
+    }
+    return false;
+}
+
+static void StressWorker(int t, const StressConfig* cfg, const TString* prefix, StressResult* res,
+                         std::atomic<int>* ready, std::atomic<bool>* go) {
+    StressFiles files(cfg->files);
+    res->bytes = 0;
+    res->err = 0;
+    res->what = NULL;
+
+    for (int f = 0; f < cfg->files; f++) {
+        if (!files.Create(*prefix + Num(t) + _T(".") + Num(f))) {
+            res->err = IoLastError();
+            res->what = _T("Cannot create a stress file");
+            break;
+        }
+    }
+    ++*ready;
+    while (!*go) std::this_thread::yield();     // all threads start growing together
+
+    res->lat.reserve((size_t)(cfg->files * ((cfg->extendTo + cfg->stride - 1) / cfg->stride)));
+    for (unsigned long long cur = 0; cur < cfg->extendTo && res->err == 0 && !stressStop; cur += cfg->stride) {
+        unsigned long long n = std::min(cfg->stride, cfg->extendTo - cur);
+        for (int f = 0; f < files.Count() && !stressStop; f++) {
+            long long t0 = NowNs();
+            if (!StressExtend(files.Get(f), cfg->method, cur, n)) {
+                res->err = IoLastError();
+                res->what = _T("Growing a stress file failed");
+                break;
+            }
+            res->lat.push_back(NowNs() - t0);
+            res->bytes += n;
+        }
+    }
+    res->tEnd = NowNs();
+
+    for (int f = 0; f < files.Count(); f++) res->extents.push_back(Fiemap(files.Get(f), false));
+}
+
+static double Percentile(std::vector<long long>& v, double p) {
+    if (v.empty()) return 0;
+    size_t k = (size_t)(p * (double)(v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return (double)v[k];
+}
+
+// [82] One scaling level: start n threads, release them together, collect.
+static bool StressLevel(int n, const StressConfig& cfg, const TString& prefix, FILE* csv) {
+    std::vector<StressResult> res(n);
+    std::vector<std::thread> threads;
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+
+    for (int t = 0; t < n; t++) threads.push_back(std::thread(StressWorker, t, &cfg, &prefix, &res[t], &ready, &go));
+    while (ready < n) std::this_thread::yield();
+    long long t0 = NowNs();
+    go = true;
+    for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+
+    unsigned long long bytes = 0, steps = 0;
+    long long tEnd = t0;
+    double p50Min = 1e300, p50Max = 0, p99Min = 1e300, p99Max = 0, extSum = 0;
+    long extMax = -1, extFiles = 0;
+    for (int t = 0; t < n; t++) {
+        StressResult& r = res[t];
+        if (r.err != 0) {
+            IoReportError(r.what, r.err, TRUE);
+            return false;
+        }
+        double p50 = Percentile(r.lat, 0.50) / 1e3, p99 = Percentile(r.lat, 0.99) / 1e3;
+        double mx = r.lat.empty() ? 0 : *std::max_element(r.lat.begin(), r.lat.end()) / 1e3;
+        double secs = (r.tEnd - t0) / 1e9, tExtSum = 0;
+        long tExtMax = -1;
+        for (size_t f = 0; f < r.extents.size(); f++) {
+            if (r.extents[f] < 0) continue;
+            tExtSum += r.extents[f];
+            tExtMax = std::max(tExtMax, r.extents[f]);
+            extFiles++;
+        }
+        if (csv != NULL) {
+            fprintf(csv, "%d,%d,%zu,%llu,%.6f,%.1f,%.1f,%.1f,%.1f,%.2f,%ld\n", n, t, r.lat.size(), r.bytes, secs,
+                    secs > 0 ? r.bytes / secs / 1e6 : 0.0, p50, p99, mx,
+                    tExtMax < 0 ? -1.0 : tExtSum / r.extents.size(), tExtMax);
+        }
+        bytes += r.bytes;
+        steps += r.lat.size();
+        tEnd = std::max(tEnd, r.tEnd);
+        p50Min = std::min(p50Min, p50); p50Max = std::max(p50Max, p50);
+        p99Min = std::min(p99Min, p99); p99Max = std::max(p99Max, p99);
+        extSum += tExtSum;
+        extMax = std::max(extMax, tExtMax);
+    }
+
+    double secs = (tEnd - t0) / 1e9;
+    double mbs = secs > 0 ? bytes / secs / 1e6 : 0, sps = secs > 0 ? steps / secs : 0;
+    _tprintf(_T("%7d %10.1f %10.0f %10.1f..%-9.1f %10.1f..%-9.1f"), n, mbs, sps, p50Min, p50Max, p99Min, p99Max);
+    if (extFiles > 0) _tprintf(_T(" %9.1f %6ld\n"), extSum / extFiles, extMax);
+    else _tprintf(_T(" %9s %6s\n"), _T("n/a"), _T("n/a"));
+    fflush(stdout);
+    if (csv != NULL) {
+        fprintf(csv, "%d,all,%llu,%llu,%.6f,%.1f,,,,%.2f,%ld\n", n, steps, bytes, secs, mbs,
+                extFiles > 0 ? extSum / extFiles : -1.0, extMax);
+        fflush(csv);
+    }
+    return true;
+}
+
+static int RunStress(const TCHAR* threadList, const StressConfig& cfg, const TCHAR* csvPath, const TCHAR* dir) {
+    std::vector<unsigned long long> levels;
+    if (!ParseSizeList(threadList, &levels) || levels.front() == 0 || levels.back() > 1024) {
+        IoReportError(_T("Bad --stress thread list (e.g. 4, 1,2,4 or 1..16)"), 0, FALSE);
+        return 1;
+    }
+
+    FILE* csv = NULL;
+    if (csvPath != NULL) {
+        if ((csv = _tfopen(csvPath, _T("w"))) == NULL) {
+            IoReportError(_T("Cannot create the CSV file"), IoLastError(), TRUE);
+            return 1;
+        }
+        fprintf(csv, "threads,thread,steps,bytes,seconds,mb_s,p50_us,p99_us,max_us,extents_avg,extents_max\n");
+    }
+
+    TString prefix = TString(dir != NULL ? dir : _T(".")) + _T("/TempTestFile.stress.") + Num(IoProcessId()) + _T(".");
+    static const TCHAR* methods[] = { _T("write"), _T("fallocate"), _T("truncate") };
+    _tprintf(_T("%d files/thread, %llu-byte steps to %llu bytes each, method %s\n\n"), cfg.files, cfg.stride,
+             cfg.extendTo, methods[cfg.method]);
+    _tprintf(_T("%7s %10s %10s %21s %21s %9s %6s\n"), _T("threads"), _T("MB/s"), _T("steps/s"),
+             _T("p50 us (per thread)"), _T("p99 us (per thread)"), _T("ext/file"), _T("max"));
+
+    void (*oldInt)(int) = signal(SIGINT, StressInterrupt);
+    int rc = 0;
+    for (size_t i = 0; i < levels.size() && rc == 0; i++) {
+        if (!StressLevel((int)levels[i], cfg, prefix, csv)) rc = 2;
+        else if (stressStop) {
+            IoReportError(_T("Interrupted; stress files removed"), 0, FALSE);
+            rc = 130;
+        }
+    }
+    signal(SIGINT, oldInt);
+
+    if (csv != NULL) fclose(csv);
+    return rc;
+}
+
+// [90] Queue depth: the interactive mode's one synchronous 256-byte write
+// at FileLenH ([26]-[28]), grown into a positioned-write benchmark. For each
+// depth in DEPTHS (list/range syntax as for --sweep) it keeps that many
+// block writes in flight against a preallocated file. It reports IOPS,
+// MB/s and latency percentiles, measured from submission to completion.
+// The point to look for is the depth where IOPS stops rising and p99
+// starts to climb.
+//   seq     block after block, wrapping at --file-size
+//   stride  every --stride bytes; each wrap shifts by one block so the
+//           same offsets are not rewritten every pass
+//   random  a uniformly chosen block each time (stateless hash of the op
+//           index, so every engine and every run writes the same sequence)
+// Engines:
+//   uring       io_uring via the raw syscalls (no liburing): one submit and
+//               reap loop on one thread, IORING_OP_WRITE with the offset.
+//   overlapped  Win32: WriteFile with the offset in an OVERLAPPED, as in
+//               [26], on a FILE_FLAG_OVERLAPPED handle with completions
+//               from an I/O completion port.
+//   threads     depth threads each doing a blocking IoWriteAt. The portable
+//               fallback, and what auto picks where io_uring is refused.
+// Writes are O_DIRECT (Win32: FILE_FLAG_NO_BUFFERING) unless --buffered is
+// given or the filesystem refuses it; direct runs need --block, --stride
+// and --file-size in multiples of QD_DIRECT_ALIGN, and a depth whose writes
+// fell back to buffered is reported as an error, not as a direct result.
+// Buffered writes only measure the page cache. The file is zero-filled and synced before the first depth,
+// so block allocation is not part of the measurement, and it is synced
+// again between depths, outside the timing.
+
+#define QD_MAX 4096
+#define QD_DIRECT_ALIGN 4096          // logical block size O_DIRECT transfers must be multiples of
+
+static const TCHAR* const qdPatternNames[] = { _T("seq"), _T("stride"), _T("random") };
+static const TCHAR* const qdEngineNames[] = { _T("auto"), _T("io_uring"), _T("threads"), _T("overlapped") };
+
+static unsigned long long SplitMix64(unsigned long long x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// [91] QdOffset: file offset of the i-th write. Pure function of i.
+static unsigned long long QdOffset(const QdConfig& cfg, unsigned long long i) {
+    unsigned long long blocks = cfg.fileSize / cfg.block;
+    switch (cfg.pattern) {
+    case QD_SEQ:
+        return i % blocks * cfg.block;
+    case QD_STRIDE: {
+        unsigned long long step = cfg.stride / cfg.block, pos = i * step;
+        return (pos + pos / blocks) % blocks * cfg.block;
+    }
+    case QD_RANDOM:
+        return SplitMix64(i) % blocks * cfg.block;
+    }
+    return 0;
+}
+
+// One in-flight write: its buffer and when it was submitted.
+struct QdSlot {
+#ifdef _WIN32
+    OVERLAPPED ov;              // first, so a completion's OVERLAPPED* is the slot
+#endif
+    BYTE* buf;
+    long long t0;
+};
+
+struct QdRun {
+    std::vector<long long> lat;
+    long long elapsed;
+};
+
+#ifdef __linux__
+// [92] Uring: the three shared mappings of an io_uring instance and the
+// ring indices inside them. Only one thread touches it: plain stores for
+// the SQE contents, release on the SQ tail and CQ head, acquire on the CQ
+// tail, as io_uring(7) requires.
+class Uring {
+public:
+    Uring() : fd(-1), sq(MAP_FAILED), cq(MAP_FAILED), sqes((io_uring_sqe*)MAP_FAILED), sqLen(0), cqLen(0), sqesLen(0) {}
+    ~Uring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesLen);
+        if (cq != MAP_FAILED && cq != sq) munmap(cq, cqLen);
+        if (sq != MAP_FAILED) munmap(sq, sqLen);
+        if (fd >= 0) close(fd);
+    }
+
+    bool Init(unsigned entries) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (fd < 0) return false;
+        sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqLen = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) sqLen = cqLen = std::max(sqLen, cqLen);
+        sq = mmap(NULL, sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq == MAP_FAILED) return false;
+        cq = single ? sq : mmap(NULL, cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) return false;
+        sqesLen = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(NULL, sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return false;
+
+        sqTail = (unsigned*)((char*)sq + p.sq_off.tail);
+        sqMask = *(unsigned*)((char*)sq + p.sq_off.ring_mask);
+        sqArray = (unsigned*)((char*)sq + p.sq_off.array);
+        cqHead = (unsigned*)((char*)cq + p.cq_off.head);
+        cqTail = (unsigned*)((char*)cq + p.cq_off.tail);
+        cqMask = *(unsigned*)((char*)cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)((char*)cq + p.cq_off.cqes);
+        tail = *sqTail;
+        return true;
+    }
+
+    // Queue a write; the caller never has more in flight than entries.
+    void Write(int file, const void* buf, unsigned len, unsigned long long off, unsigned long long data) {
+        unsigned idx = tail & sqMask;
+        io_uring_sqe* sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = file;
+        sqe->addr = (unsigned long long)(uintptr_t)buf;
+        sqe->len = len;
+        sqe->off = off;
+        sqe->user_data = data;
+        sqArray[idx] = idx;
+        tail++;
+    }
+
+    // Publish queued SQEs, submit them and wait for at least wait completions.
+    bool Enter(unsigned submit, unsigned wait) {
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        for (;;) {
+            long r = syscall(__NR_io_uring_enter, fd, submit, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (r >= 0 || errno != EINTR) return r >= 0;   // EINTR: interrupted before submitting
+        }
+    }
+
+    bool Reap(io_uring_cqe* out) {
+        unsigned head = *cqHead;
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return false;
+        *out = cqes[head & cqMask];
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    Uring(const Uring&);
+    Uring& operator=(const Uring&);
+
+    int fd;
+    void *sq, *cq;
+    io_uring_sqe* sqes;
+    size_t sqLen, cqLen, sqesLen;
+    unsigned *sqTail, *sqArray, *cqHead, *cqTail;
+    unsigned sqMask, cqMask, tail;
+    io_uring_cqe* cqes;
+};
+
+// Keep depth writes in flight until cfg.ops have completed.
+static bool QdUring(HANDLE h, const QdConfig& cfg, int depth, std::vector<QdSlot>& slots, QdRun* run) {
+    Uring ring;
+    std::vector<int> freeSlots;
+    unsigned long long issued = 0, done = 0;
+    unsigned entries = 1;
+    while (entries < (unsigned)depth) entries <<= 1;
+    if (!ring.Init(entries)) return false;
+    for (int s = depth - 1; s >= 0; s--) freeSlots.push_back(s);
+
+    long long tStart = NowNs();
+    while (done < cfg.ops) {
+        unsigned queued = 0;
+        while (!freeSlots.empty() && issued < cfg.ops) {
+            int s = freeSlots.back();
+            freeSlots.pop_back();
+            slots[s].t0 = NowNs();
+            ring.Write(h, slots[s].buf, (unsigned)cfg.block, QdOffset(cfg, issued++), (unsigned long long)s);
+            queued++;
+        }
+        if (!ring.Enter(queued, 1)) return false;
+        io_uring_cqe cqe;
+        while (ring.Reap(&cqe)) {
+            long long t1 = NowNs();
+            if (cqe.res != (int)cfg.block) {
+                errno = cqe.res < 0 ? -cqe.res : EIO;  // a short write counts as an error
+                return false;
+            }
+            run->lat.push_back(t1 - slots[cqe.user_data].t0);
+            freeSlots.push_back((int)cqe.user_data);
+            done++;
+        }
+    }
+    run->elapsed = NowNs() - tStart;
+    return true;
+}
+#endif
+
+#ifdef _WIN32
+// [93] Overlapped: the [26] OVERLAPPED write, depth at a time, completions
+// from an I/O completion port in whatever order the device finishes them.
+static bool QdOverlapped(const TCHAR* path, const QdConfig& cfg, int depth, std::vector<QdSlot>& slots, QdRun* run) {
+    DWORD flags = FILE_FLAG_OVERLAPPED | (cfg.direct ? FILE_FLAG_NO_BUFFERING : 0);
+    HANDLE h = CreateFile(path, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, flags, NULL);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    HANDLE port = CreateIoCompletionPort(h, NULL, 0, 1);
+    if (port == NULL) {
+        CloseHandle(h);
+        return false;
+    }
+
+    unsigned long long issued = 0, done = 0;
+    int inFlight = 0;
+    bool ok = true;
+    long long tStart = NowNs();
+    for (int s = 0; s < depth && issued < cfg.ops; s++, inFlight++) {
+        unsigned long long off = QdOffset(cfg, issued++);
+        memset(&slots[s].ov, 0, sizeof(OVERLAPPED));
+        slots[s].ov.Offset = (DWORD)off;
+        slots[s].ov.OffsetHigh = (DWORD)(off >> 32);
+        slots[s].t0 = NowNs();
+        if (!WriteFile(h, slots[s].buf, (DWORD)cfg.block, NULL, &slots[s].ov) && GetLastError() != ERROR_IO_PENDING) {
+            ok = false;
+            break;
+        }
+    }
+    while (ok && done < cfg.ops) {
+        DWORD n;
+        ULONG_PTR key;
+        OVERLAPPED* ov;
+        if (!GetQueuedCompletionStatus(port, &n, &key, &ov, INFINITE) || n != cfg.block) {
+            ok = false;
+            break;
+        }
+        QdSlot* slot = (QdSlot*)ov;
+        run->lat.push_back(NowNs() - slot->t0);
+        done++;
+        inFlight--;
+        if (issued < cfg.ops) {
+            unsigned long long off = QdOffset(cfg, issued++);
+            memset(&slot->ov, 0, sizeof(OVERLAPPED));
+            slot->ov.Offset = (DWORD)off;
+            slot->ov.OffsetHigh = (DWORD)(off >> 32);
+            slot->t0 = NowNs();
+            if (!WriteFile(h, slot->buf, (DWORD)cfg.block, NULL, &slot->ov) && GetLastError() != ERROR_IO_PENDING) ok = false;
+            else inFlight++;
+        }
+    }
+    run->elapsed = NowNs() - tStart;
+    IoError err = IoLastError();
+    if (!ok) CancelIo(h);                         // CloseHandle waits for the cancelled writes
+    CloseHandle(h);
+    CloseHandle(port);
+    SetLastError(err);
+    return ok;
+}
+#endif
+
+// [94] Threads: depth blocking writers share one op counter.
+static bool QdThreads(HANDLE h, const QdConfig& cfg, int depth, std::vector<QdSlot>& slots, QdRun* run) {
+    std::atomic<unsigned long long> next(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::vector<long long> > lat(depth);
+    std::vector<IoError> errs(depth, 0);
+    std::vector<std::thread> threads;
+
+    long long tStart = NowNs();
+    for (int t = 0; t < depth; t++) {
+        threads.push_back(std::thread([&, t] {
+            lat[t].reserve((size_t)(cfg.ops / depth + 1));
+            for (unsigned long long i; !failed && (i = next++) < cfg.ops;) {
+                long long t0 = NowNs();
+                if (!IoWriteAt(h, slots[t].buf, (size_t)cfg.block, QdOffset(cfg, i))) {
+                    errs[t] = IoLastError();
+                    failed = true;
+                    break;
+                }
+                lat[t].push_back(NowNs() - t0);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+    run->elapsed = NowNs() - tStart;
+
+    for (int t = 0; t < depth; t++) {
+        if (errs[t] != 0) {
+#ifdef _WIN32
+            SetLastError(errs[t]);
+#else
+            errno = errs[t];
+#endif
+            return false;
+        }
+        run->lat.insert(run->lat.end(), lat[t].begin(), lat[t].end());
+    }
+    return true;
+}
+
+// [95] Deletes the benchmark file on every way out of RunQd.
+struct QdTempFile {
+    TString path;
+    bool created;
+    QdTempFile() : created(false) {}
+    ~QdTempFile() {
+        if (created) IoDelete(path.c_str());
+    }
+};
+
+static int RunQd(const TCHAR* depthList, const QdConfig& cfgIn, const TCHAR* csvPath, const TCHAR* dir) {
+    QdConfig cfg = cfgIn;
+    std::vector<unsigned long long> depths;
+    if (!ParseSizeList(depthList, &depths) || depths.front() == 0 || depths.back() > QD_MAX) {
+        IoReportError(_T("Bad --qd depth list (e.g. 1..64 or 1,4,16; at most 4096)"), 0, FALSE);
+        return 1;
+    }
+    if (cfg.direct && (cfg.block % QD_DIRECT_ALIGN != 0 || cfg.stride % QD_DIRECT_ALIGN != 0
+                       || cfg.fileSize % QD_DIRECT_ALIGN != 0)) {
+        IoReportError(_T("Direct writes need --block, --stride and --file-size in multiples of 4096 (or --buffered)"),
+                      0, FALSE);
+        return 1;
+    }
+    cfg.fileSize = cfg.fileSize / cfg.block * cfg.block;
+    cfg.stride = cfg.stride / cfg.block * cfg.block;
+    if (cfg.ops == 0) cfg.ops = std::min(cfg.fileSize / cfg.block, 65536ull);
+
+    // [96] Engine choice: auto means io_uring on Linux (threads if the
+    // kernel refuses it) and overlapped I/O on Win32.
+    QdEngine engine = cfg.engine;
+#if defined(_WIN32)
+    if (engine == QD_AUTO) engine = QD_OVERLAPPED;
+    if (engine == QD_URING) {
+        IoReportError(_T("--engine=uring is Linux only"), 0, FALSE);
+        return 1;
+    }
+#else
+    if (engine == QD_OVERLAPPED) {
+        IoReportError(_T("--engine=overlapped is Win32 only"), 0, FALSE);
+        return 1;
+    }
+#ifdef __linux__
+    if (engine == QD_AUTO) {
+        Uring probe;
+        engine = probe.Init(1) ? QD_URING : QD_THREADS;
+    }
+#else
+    if (engine == QD_URING) {
+        IoReportError(_T("--engine=uring is Linux only"), 0, FALSE);
+        return 1;
+    }
+    if (engine == QD_AUTO) engine = QD_THREADS;
+#endif
+#endif
+
+    FILE* csv = NULL;
+    if (csvPath != NULL) {
+        if ((csv = _tfopen(csvPath, _T("w"))) == NULL) {
+            IoReportError(_T("Cannot create the CSV file"), IoLastError(), TRUE);
+            return 1;
+        }
+        fprintf(csv, "qd,engine,pattern,block,ops,seconds,iops,mb_s,p50_us,p90_us,p99_us,p999_us,max_us\n");
+    }
+
+    // [97] The target file: created O_EXCL, zero-filled, synced.
+    QdTempFile tmp;
+    tmp.path = TString(dir != NULL ? dir : _T(".")) + _T("/TempTestFile.qd.") + Num(IoProcessId());
+    IoFile hFile;
+    if (!hFile.Open(tmp.path.c_str(), IO_CREATE_NEW)) {
+        IoReportError(_T("Cannot create the benchmark file"), IoLastError(), TRUE);
+        if (csv != NULL) fclose(csv);
+        return 2;
+    }
+    tmp.created = true;
+    if (!AllocZero(hFile.Get(), cfg.fileSize) || !IoSyncData(hFile.Get())) {
+        IoReportError(_T("Cannot fill the benchmark file"), IoLastError(), TRUE);
+        if (csv != NULL) fclose(csv);
+        return 2;
+    }
+#ifdef _WIN32
+    if (engine == QD_OVERLAPPED) hFile.Close();       // reopened per depth with FILE_FLAG_OVERLAPPED
+#endif
+    bool direct = cfg.direct;
+    if (hFile.Valid() && direct && !IoDirectEnable(hFile.Get())) direct = false;
+
+    IoBufPool pool;
+    int maxDepth = (int)depths.back();
+    std::vector<QdSlot> slots(maxDepth);
+    std::vector<std::unique_ptr<IoBuf> > bufs;
+    for (int s = 0; s < maxDepth; s++) {
+        bufs.push_back(std::unique_ptr<IoBuf>(new IoBuf(pool, (size_t)cfg.block)));   // page-aligned, as O_DIRECT needs
+        slots[s].buf = bufs.back()->Get();
+        memset(slots[s].buf, 0x5A, (size_t)cfg.block);
+    }
+
+    _tprintf(_T("Positioned writes: %s, %llu-byte blocks over %llu bytes, %llu ops per depth, %s, %s\n\n"),
+             qdPatternNames[cfg.pattern], cfg.block, cfg.fileSize, cfg.ops, qdEngineNames[engine],
+             direct ? _T("direct") : _T("buffered (page cache only)"));
+    _tprintf(_T("%6s %10s %9s %9s %9s %9s %9s %9s\n"), _T("qd"), _T("IOPS"), _T("MB/s"), _T("p50 us"),
+             _T("p90 us"), _T("p99 us"), _T("p99.9 us"), _T("max us"));
+
+    int rc = 0;
+    for (size_t i = 0; i < depths.size() && rc == 0; i++) {
+        int depth = (int)depths[i];
+        QdRun run;
+        run.lat.reserve((size_t)cfg.ops);
+        bool ok;
+        switch (engine) {
+#ifdef __linux__
+        case QD_URING: ok = QdUring(hFile.Get(), cfg, depth, slots, &run); break;
+#endif
+#ifdef _WIN32
+        case QD_OVERLAPPED: ok = QdOverlapped(tmp.path.c_str(), cfg, depth, slots, &run); break;
+#endif
+        default: ok = QdThreads(hFile.Get(), cfg, depth, slots, &run); break;
+        }
+        if (!ok) {
+            IoReportError(_T("Benchmark write failed"), IoLastError(), TRUE);
+            rc = 3;
+            break;
+        }
+        if (hFile.Valid() && direct && !IoDirectActive(hFile.Get())) {  // IoWriteAt fell back to buffered
+            IoReportError(_T("Direct I/O was dropped during the run; its results would be buffered"), 0, FALSE);
+            rc = 3;
+            break;
+        }
+        if (hFile.Valid()) IoSyncData(hFile.Get());   // leave nothing dirty for the next depth
+
+        std::sort(run.lat.begin(), run.lat.end());
+        size_t n = run.lat.size();
+        double pct[4] = { 0.50, 0.90, 0.99, 0.999 }, us[4];
+        for (int k = 0; k < 4; k++) us[k] = run.lat[(size_t)(pct[k] * (double)(n - 1))] / 1e3;
+        double secs = run.elapsed / 1e9, mx = run.lat.back() / 1e3;
+        double iops = n / secs, mbs = n * (double)cfg.block / secs / 1e6;
+        _tprintf(_T("%6d %10.0f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n"), depth, iops, mbs, us[0], us[1], us[2], us[3], mx);
+        fflush(stdout);
+        if (csv != NULL) {
+#if defined(_WIN32) && defined(_UNICODE)
+            fprintf(csv, "%d,%ls,%ls,", depth, qdEngineNames[engine], qdPatternNames[cfg.pattern]);
+#else
+            fprintf(csv, "%d,%s,%s,", depth, qdEngineNames[engine], qdPatternNames[cfg.pattern]);
+#endif
+            fprintf(csv, "%llu,%zu,%.6f,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", cfg.block, n, secs, iops, mbs,
+                    us[0], us[1], us[2], us[3], mx);
+            fflush(csv);
+        }
+    }
+
+    if (csv != NULL) fclose(csv);
+    return rc;
+}
+
+// [100] Monitor: ReportSpace as a background sampler instead of a one-off.
+// Every mount in the comma list is sampled at --rate Hz until --duration
+// seconds have passed (0: until Ctrl-C). Two threads:
+//   sampler   wakes on an absolute schedule, takes one space reading per
+//             mount and pushes it into a fixed lock-free ring. It does
+//             nothing else: no formatting, no I/O, no allocation, no lock.
+//             On Linux each mount is opened once (O_PATH) and read with
+//             fstatvfs, so a reading is one syscall and no path lookup.
+//   consumer  (the calling thread) drains the ring a few times a second,
+//             writes the samples out and evaluates the alerts, so slow
+//             output never delays a sample. If it falls more than
+//             MONITOR_RING samples behind, the sampler drops samples and
+//             counts them instead of blocking.
+// Missed ticks (the sampler woke late by a whole period or more) are
+// skipped, not caught up with a burst, and counted.
+//
+// Output: one console line per mount per second; --csv=FILE and/or
+// --bin=FILE get every sample. The binary file is
+//   "FSMON001", u32 mounts, u32 record size,
+//   per mount: u32 byte length and the path as it was given,
+//   then records: i64 t_ns (Unix epoch), u32 mount, u32 err, u64 total,
+//   u64 free, u64 avail (40 bytes, host byte order).
+// The CSV has the same fields with the path in place of the index.
+//
+// Alerts (stderr, edge-triggered: one line when the condition starts, one
+// when it clears):
+//   --alert-free=SIZE|PCT%   available space below SIZE, or below PCT of total
+//   --alert-ttf=SECONDS      projected time until available space is gone,
+//                            at the current consumption rate, below SECONDS.
+// The rate is an exponentially weighted average of d(avail)/dt over about
+// --window seconds (default 60), so single-block noise at 100 Hz does not
+// trigger it.
+
+#define MONITOR_RING 8192            // samples; a power of two
+#define MONITOR_DRAIN_MS 100         // consumer wake-up interval
+
+static std::atomic<bool> monitorStop(false);
+
+static void MonitorInterrupt(int) {
+    monitorStop = true;
+}
+
+struct MonitorSample {
+    long long tNs;
+    unsigned mount, err;
+    unsigned long long total, free, avail;
+};
+
+// [101] MonitorRing: single producer, single consumer. head is written only
+// by the sampler and tail only by the consumer; each reads the other's with
+// acquire, so a slot's contents are visible before its index is. The two
+// indices are 64 bytes apart so the threads do not share a cache line.
+class MonitorRing {
+public:
+    MonitorRing() : head(0), tail(0), dropped(0) {}
+
+    bool Push(const MonitorSample& s) {
+        unsigned long long h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == MONITOR_RING) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[h % MONITOR_RING] = s;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(MonitorSample* s) {
+        unsigned long long t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return false;
+        *s = slots[t % MONITOR_RING];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    unsigned long long Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    typedef std::atomic<unsigned long long> Index;
+    Index head;
+    char pad0[64 - sizeof(Index)];   // padding, not alignas: C++14 new ignores over-alignment
+    Index tail;
+    char pad1[64 - sizeof(Index)];
+    Index dropped;
+    MonitorSample slots[MONITOR_RING];
+};
+
+// [102] MonitorMount: one watched path. On Linux fd pins the filesystem the
+// path was on at startup; elsewhere every reading goes through the path.
+struct MonitorMount {
+    TString path;
+#ifdef __linux__
+    int fd;
+#endif
+    // Consumer-side state.
+    long long tPrev;
+    unsigned long long availPrev;
+    double rate;                     // bytes/s consumed (negative: freed)
+    bool lowAlert, ttfAlert;
+    long long tPrinted;
+};
+
+static unsigned MonitorRead(MonitorMount& m, IoSpace* sp) {
+#ifdef __linux__
+    if (m.fd >= 0) {
+        struct statvfs vfs;
+        if (fstatvfs(m.fd, &vfs) != 0) return (unsigned)errno;
+        sp->total = (unsigned long long)vfs.f_blocks * vfs.f_frsize;
+        sp->free = (unsigned long long)vfs.f_bfree * vfs.f_frsize;
+        sp->avail = (unsigned long long)vfs.f_bavail * vfs.f_frsize;
+        return 0;
+    }
+#endif
+    return IoDiskSpace(m.path.c_str(), sp) ? 0 : (unsigned)IoLastError();
+}
+
+struct MonitorStats {
+    unsigned long long rounds, missed;
+    long long readNs;                // time spent inside MonitorRead, all mounts
+};
+
+static long long WallNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// [103] Sampler thread: sleep_until on steady-clock deadlines, so the rate
+// does not drift with the time a round takes.
+static void MonitorSampler(std::vector<MonitorMount>* mounts, const MonitorConfig* cfg, MonitorRing* ring,
+                           MonitorStats* st) {
+    typedef std::chrono::steady_clock Clock;
+    const Clock::duration period = std::chrono::nanoseconds(1000000000LL / cfg->rate);
+    Clock::time_point next = Clock::now(), end = next + std::chrono::seconds(cfg->duration);
+    while (!monitorStop && (cfg->duration == 0 || next < end)) {
+        std::this_thread::sleep_until(next);
+        long long t = WallNs(), t0 = NowNs();
+        for (size_t i = 0; i < mounts->size(); i++) {
+            MonitorSample s = { t, (unsigned)i, 0, 0, 0, 0 };
+            IoSpace sp = { 0, 0, 0 };
+            s.err = MonitorRead((*mounts)[i], &sp);
+            s.total = sp.total;
+            s.free = sp.free;
+            s.avail = sp.avail;
+            ring->Push(s);
+        }
+        st->readNs += NowNs() - t0;
+        st->rounds++;
+        next += period;
+        Clock::time_point now = Clock::now();
+        if (now >= next + period) {  // overslept by whole periods: skip them
+            long long behind = (long long)((now - next) / period);
+            st->missed += (unsigned long long)behind;
+            next += behind * period;
+        }
+    }
+    monitorStop = true;
+}
+
+// [104] Rate, time-to-full and the alert edges for one sample.
+static void MonitorAlerts(MonitorMount& m, const MonitorSample& s, const MonitorConfig& cfg) {
+    const double GB = 1024.0 * 1024.0 * 1024.0;
+    if (m.tPrev != 0 && s.tNs > m.tPrev) {
+        double dt = (s.tNs - m.tPrev) / 1e9;
+        double inst = ((double)m.availPrev - (double)s.avail) / dt;
+        double alpha = 1.0 - exp(-dt / cfg.window);
+        m.rate += alpha * (inst - m.rate);
+    }
+    m.tPrev = s.tNs;
+    m.availPrev = s.avail;
+
+    if (cfg.alertFree != 0 || cfg.alertPct > 0) {
+        double limit = cfg.alertPct > 0 ? s.total * cfg.alertPct / 100.0 : (double)cfg.alertFree;
+        bool low = s.avail < limit;
+        if (low != m.lowAlert)
+            _ftprintf(stderr, low ? _T("ALERT %s: %.2f GB available, below %.2f GB\n")
+                                  : _T("clear %s: %.2f GB available, above %.2f GB\n"),
+                      m.path.c_str(), s.avail / GB, limit / GB);
+        m.lowAlert = low;
+    }
+    if (cfg.alertTtf > 0) {
+        double ttf = m.rate > 0 ? s.avail / m.rate : -1;
+        bool soon = ttf >= 0 && ttf < cfg.alertTtf;
+        if (soon && !m.ttfAlert)
+            _ftprintf(stderr, _T("ALERT %s: full in %.0f s at %.2f MB/s\n"), m.path.c_str(), ttf, m.rate / 1e6);
+        else if (!soon && m.ttfAlert)
+            _ftprintf(stderr, _T("clear %s: consumption %.2f MB/s\n"), m.path.c_str(), m.rate / 1e6);
+        m.ttfAlert = soon;
+    }
+}
+
+static bool MonitorWriteAll(FILE* f, const void* p, size_t n) {
+    return fwrite(p, 1, n, f) == n;
+}
+
+static int RunMonitor(const TCHAR* pathList, const MonitorConfig& cfg, const TCHAR* csvPath, const TCHAR* binPath) {
+    const double GB = 1024.0 * 1024.0 * 1024.0;
+    std::vector<MonitorMount> mounts;
+    for (const TCHAR* p = pathList; *p;) {
+        const TCHAR* q = p;
+        while (*q && *q != _T(',')) q++;
+        MonitorMount m = MonitorMount();
+        m.path.assign(p, q);
+#ifdef __linux__
+        m.fd = open(m.path.c_str(), O_PATH | O_CLOEXEC);   // a handle to the filesystem, not an open file
+#endif
+        IoSpace sp;
+        if (m.path.empty() || MonitorRead(m, &sp) != 0) {
+            IoReportError((_T("Cannot read free space for '") + m.path + _T("'")).c_str(), IoLastError(), TRUE);
+#ifdef __linux__
+            if (m.fd >= 0) close(m.fd);
+            for (size_t i = 0; i < mounts.size(); i++)
+                if (mounts[i].fd >= 0) close(mounts[i].fd);
+#endif
+            return 1;
+        }
+        mounts.push_back(m);
+        p = *q ? q + 1 : q;
+    }
+    if (mounts.empty()) {
+        IoReportError(_T("Bad --monitor list (comma-separated paths)"), 0, FALSE);
+        return 1;
+    }
+
+    FILE *csv = NULL, *bin = NULL;
+    if (csvPath != NULL && (csv = _tfopen(csvPath, _T("w"))) == NULL) {
+        IoReportError(_T("Cannot create the CSV file"), IoLastError(), TRUE);
+        return 1;
+    }
+    if (binPath != NULL && (bin = _tfopen(binPath, _T("wb"))) == NULL) {
+        IoReportError(_T("Cannot create the binary file"), IoLastError(), TRUE);
+        if (csv != NULL) fclose(csv);
+        return 1;
+    }
+    if (csv != NULL) fprintf(csv, "t_ns,mount,total,free,avail,err\n");
+    if (bin != NULL) {
+        unsigned hdr[2] = { (unsigned)mounts.size(), (unsigned)sizeof(MonitorSample) };
+        MonitorWriteAll(bin, "FSMON001", 8);
+        MonitorWriteAll(bin, hdr, sizeof(hdr));
+        for (size_t i = 0; i < mounts.size(); i++) {
+            unsigned len = (unsigned)(mounts[i].path.size() * sizeof(TCHAR));
+            MonitorWriteAll(bin, &len, sizeof(len));
+            MonitorWriteAll(bin, mounts[i].path.c_str(), len);
+        }
+    }
+
+    _tprintf(_T("Monitoring %zu mount(s) at %d Hz%s; Ctrl-C stops\n\n"), mounts.size(), cfg.rate,
+             cfg.duration > 0 ? _T(" for a fixed duration") : _T(""));
+    _tprintf(_T("%-24s %12s %12s %7s %11s %12s\n"), _T("mount"), _T("total GB"), _T("avail GB"), _T("used"),
+             _T("MB/s used"), _T("full in s"));
+
+    std::unique_ptr<MonitorRing> ring(new MonitorRing);   // 320 KB: not on the stack
+    MonitorStats st = { 0, 0, 0 };
+    monitorStop = false;
+    void (*oldInt)(int) = signal(SIGINT, MonitorInterrupt);
+    clock_t cpu0 = clock();
+    long long t0 = NowNs();
+    std::thread sampler(MonitorSampler, &mounts, &cfg, ring.get(), &st);
+
+    // [105] Consumer: drain, export, alert; one console line per mount per second.
+    unsigned long long samples = 0;
+    bool writeFailed = false, done = false;
+    while (!done) {
+        done = monitorStop;      // read before draining: nothing pushed before the stop is lost
+        MonitorSample s;
+        while (ring->Pop(&s)) {
+            MonitorMount& m = mounts[s.mount];
+            samples++;
+            if (bin != NULL && !MonitorWriteAll(bin, &s, sizeof(s))) writeFailed = true;
+            if (csv != NULL) {
+#if defined(_WIN32) && defined(_UNICODE)
+                fprintf(csv, "%lld,%ls,%llu,%llu,%llu,%u\n", s.tNs, m.path.c_str(), s.total, s.free, s.avail, s.err);
+#else
+                fprintf(csv, "%lld,%s,%llu,%llu,%llu,%u\n", s.tNs, m.path.c_str(), s.total, s.free, s.avail, s.err);
+#endif
+            }
+            if (s.err != 0) {
+                if (s.tNs - m.tPrinted >= 1000000000LL) {
+                    IoReportError((_T("Cannot read free space for '") + m.path + _T("'")).c_str(), s.err, TRUE);
+                    m.tPrinted = s.tNs;
+                }
+                continue;
+            }
+            MonitorAlerts(m, s, cfg);
+            if (s.tNs - m.tPrinted >= 1000000000LL) {
+                double used = s.total > 0 ? 100.0 * (s.total - s.free) / s.total : 0;
+                _tprintf(_T("%-24s %12.2f %12.2f %6.1f%% %11.2f "), m.path.c_str(), s.total / GB, s.avail / GB, used,
+                         m.rate / 1e6);
+                if (m.rate > 0) _tprintf(_T("%12.0f\n"), s.avail / m.rate);
+                else _tprintf(_T("%12s\n"), _T("-"));
+                m.tPrinted = s.tNs;
+            }
+        }
+        fflush(stdout);
+        if (csv != NULL && ferror(csv)) writeFailed = true;
+        if (writeFailed) {
+            monitorStop = true;
+            break;
+        }
+        if (!done) std::this_thread::sleep_for(std::chrono::milliseconds(MONITOR_DRAIN_MS));
+    }
+    sampler.join();
+    signal(SIGINT, oldInt);
+
+    double secs = (NowNs() - t0) / 1e9, cpu = (double)(clock() - cpu0) / CLOCKS_PER_SEC;
+    _tprintf(_T("\n%llu samples in %.1f s; %llu dropped, %llu ticks missed; %.2f us per reading; CPU %.3f%% of one core\n"),
+             samples, secs, ring->Dropped(), st.missed,
+             st.rounds > 0 ? st.readNs / 1e3 / (double)(st.rounds * mounts.size()) : 0.0,
+             secs > 0 ? 100.0 * cpu / secs : 0.0);
+
+    int rc = 0;
+    if (csv != NULL && fclose(csv) != 0) writeFailed = true;
+    if (bin != NULL && fclose(bin) != 0) writeFailed = true;
+    if (writeFailed) {
+        IoReportError(_T("Cannot write the sample file"), IoLastError(), TRUE);
+        rc = 2;
+    }
+#ifdef __linux__
+    for (size_t i = 0; i < mounts.size(); i++)
+        if (mounts[i].fd >= 0) close(mounts[i].fd);
+#endif
+    return rc;
+}
+
+// [110] Du: where the space went. Walks a directory tree with a pool of
+// --threads workers and adds up, per subtree, the logical size (st_size)
+// and the allocated size (st_blocks * 512). A large gap between the two is
+// sparse files (or compression); allocated is what the volume lost. Prints
+// the totals and the --top heaviest directories by allocated size.
+//
+// Each directory is one task. Workers own a queue each: the owner takes
+// its newest task (depth first, so few directories are open at a time)
+// and an idle worker steals another's oldest (nearest the root, so it gets
+// a big piece of work for one steal). A worker with nothing to steal
+// sleeps on a condition variable until a task is queued. The walk ends
+// when no task is queued or running.
+//
+// On Linux a directory is opened with openat() relative to its parent's
+// fd and read with getdents64 into a 64 KB buffer; each entry is one
+// fstatat() relative to the directory's fd, and none at all for
+// subdirectories, whose own size comes from fstat() once they are opened.
+// No path is ever built or resolved from the root. A parent's fd stays
+// open until its last subdirectory has been opened. Other POSIX systems do
+// the same with readdir; Win32 lists full paths with FindFirstFileEx,
+// whose entries carry the size, so no per-file call is made there but
+// allocated equals logical and hard links are not detected.
+//
+// Hard links: a file with more than one link is counted the first time
+// its (device, inode) is seen, as du does. --xdev stays on the starting
+// filesystem.
+
+#define DU_DENTS_BUF (64 << 10)
+#define DU_INODE_SHARDS 64
+#define DU_MAX_ERRORS 10             // reported one by one; the rest only counted
+
+struct DuNode {
+    DuNode(DuNode* parent, const TString& name)
+        : parent(parent), name(name), pending(1), logical(0), allocated(0), files(0), dirs(0) {
+#ifndef _WIN32
+        fd = -1;
+        openers = 1;
+#endif
+    }
+    DuNode* parent;
+    TString name;
+#ifndef _WIN32
+    int fd;
+    std::atomic<int> openers;        // own listing + subdirectories not yet openat()ed from fd
+#endif
+    std::atomic<long> pending;       // own listing + subdirectories not yet finished
+    std::atomic<unsigned long long> logical, allocated, files, dirs;   // whole subtree, once pending is 0
+};
+
+struct DuQueue {                     // [111] One per worker; owner takes the back, thieves the front.
+    std::mutex lock;
+    std::deque<DuNode*> nodes;
+};
+
+struct DuTop {
+    unsigned long long allocated, logical, files;
+    TString path;
+    bool operator<(const DuTop& o) const { return allocated > o.allocated; }   // heap top = smallest
+};
+
+struct DuInode {
+    unsigned long long dev, ino;
+    bool operator==(const DuInode& o) const { return dev == o.dev && ino == o.ino; }
+};
+struct DuInodeHash {
+    size_t operator()(const DuInode& k) const { return (size_t)SplitMix64(k.ino ^ (k.dev << 40)); }
+};
+struct DuInodeShard {
+    std::mutex lock;
+    std::unordered_set<DuInode, DuInodeHash> seen;
+};
+
+struct DuState {
+    DuState(int threads, int top, bool xdev)
+        : top(top), xdev(xdev), rootDev(0), queues(threads), work(0), queued(0), idlers(0), links(0), errors(0), topFull(top == 0), topMin(top == 0 ? ~0ULL : 0) {}
+    int top;
+    bool xdev;
+    unsigned long long rootDev;
+    std::vector<DuQueue> queues;
+    std::atomic<long> work;          // tasks queued or running
+    std::atomic<long> queued;        // tasks queued, not yet taken
+    std::atomic<int> idlers;         // workers waiting on idle
+    std::mutex idleLock;
+    std::condition_variable idle;    // signalled by DuPush and by the last task finishing
+    std::atomic<unsigned long long> links, errors;
+    std::mutex topLock;
+    std::vector<DuTop> heap;
+    std::atomic<bool> topFull;
+    std::atomic<unsigned long long> topMin;   // smallest allocated in the heap, once full
+    DuInodeShard inodes[DU_INODE_SHARDS];
+};
+
+static TString DuPath(const DuNode* n) {
+    if (n->parent == NULL) return n->name;
+    TString p = DuPath(n->parent);
+    return p.empty() || p[p.size() - 1] != _T('/') ? p + _T("/") + n->name : p + n->name;
+}
+
+static void DuError(DuState* st, const DuNode* n, unsigned long long err) {
+    if (st->errors.fetch_add(1) < DU_MAX_ERRORS)
+        IoReportError((_T("Cannot read '") + DuPath(n) + _T("'")).c_str(), err, TRUE);
+}
+
+// True the first time (dev, ino) is seen.
+static bool DuFirstLink(DuState* st, unsigned long long dev, unsigned long long ino) {
+    DuInode k = { dev, ino };
+    DuInodeShard& s = st->inodes[DuInodeHash()(k) % DU_INODE_SHARDS];
+    std::lock_guard<std::mutex> guard(s.lock);
+    return s.seen.insert(k).second;
+}
+
+static void DuPush(DuState* st, int self, DuNode* n) {
+    st->work++;
+    {
+        std::lock_guard<std::mutex> guard(st->queues[self].lock);
+        st->queues[self].nodes.push_back(n);
+    }
+    st->queued++;
+    if (st->idlers > 0) {
+        std::lock_guard<std::mutex> guard(st->idleLock);
+        st->idle.notify_one();
+    }
+}
+
+static DuNode* DuNext(DuState* st, int self) {
+    {
+        std::lock_guard<std::mutex> guard(st->queues[self].lock);
+        if (!st->queues[self].nodes.empty()) {
+            DuNode* n = st->queues[self].nodes.back();
+            st->queues[self].nodes.pop_back();
+            st->queued--;
+            return n;
+        }
+    }
+    for (size_t k = 1; k < st->queues.size(); k++) {
+        DuQueue& victim = st->queues[(self + k) % st->queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.nodes.empty()) {
+            DuNode* n = victim.nodes.front();
+            victim.nodes.pop_front();
+            st->queued--;
+            return n;
+        }
+    }
+    return NULL;
+}
+
+// [112] A finished subtree: offer it to the top-N heap, add it into its
+// parent, and finish the parent too if this was its last open piece. The
+// node is freed here; its parent cannot be, until this returns.
+static void DuFinish(DuState* st, DuNode* n) {
+    while (n != NULL) {
+        unsigned long long alloc = n->allocated;
+        if (n->dirs > 0 && (!st->topFull || alloc > st->topMin)) {
+            DuTop t = { alloc, n->logical, n->files, DuPath(n) };
+            std::lock_guard<std::mutex> guard(st->topLock);
+            if (st->heap.size() < (size_t)st->top) {
+                st->heap.push_back(t);
+                std::push_heap(st->heap.begin(), st->heap.end());
+            }
+            else if (!st->heap.empty() && alloc > st->heap.front().allocated) {
+                std::pop_heap(st->heap.begin(), st->heap.end());
+                st->heap.back() = t;
+                std::push_heap(st->heap.begin(), st->heap.end());
+            }
+            if (st->heap.size() == (size_t)st->top) {
+                st->topMin = st->heap.front().allocated;
+                st->topFull = true;
+            }
+        }
+        DuNode* p = n->parent;
+        if (p != NULL) {
+            p->logical += n->logical;
+            p->allocated += n->allocated;
+            p->files += n->files;
+            p->dirs += n->dirs;
+        }
+        delete n;
+        n = p != NULL && --p->pending == 0 ? p : NULL;
+    }
+}
+
+#ifndef _WIN32
+static void DuRelease(DuNode* n) {   // one opener less; the last one closes the fd
+    if (--n->openers == 0 && n->fd >= 0) {
+        close(n->fd);
+        n->fd = -1;
+    }
+}
+
+#ifdef __linux__
+struct DuDirent64 {                  // the kernel's struct linux_dirent64
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+#endif
+
+// [113] One directory, POSIX: open it, account its entries, queue its
+// subdirectories. Totals are summed locally and published once.
+static void DuProcess(DuState* st, int self, DuNode* n, std::vector<char>& buf) {
+    unsigned long long logical = 0, allocated = 0, files = 0;
+    struct stat sb;
+    n->fd = n->parent != NULL ? openat(n->parent->fd, n->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+                              : open(n->name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (n->parent != NULL) DuRelease(n->parent);
+    if (n->fd < 0 || fstat(n->fd, &sb) != 0) DuError(st, n, (unsigned long long)errno);
+    else if (n->parent == NULL || !st->xdev || (unsigned long long)sb.st_dev == st->rootDev) {
+        if (n->parent == NULL) st->rootDev = (unsigned long long)sb.st_dev;
+        logical += (unsigned long long)sb.st_size;
+        allocated += (unsigned long long)sb.st_blocks * 512;
+        n->dirs = 1;
+
+        // type: 1 directory, 0 something else, -1 not known without a stat.
+        auto entry = [&](const char* name, int type) {
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) return;
+            struct stat es;
+            if (type != 1) {
+                if (fstatat(n->fd, name, &es, AT_SYMLINK_NOFOLLOW) != 0) {
+                    DuError(st, n, (unsigned long long)errno);
+                    return;
+                }
+                if (!S_ISDIR(es.st_mode)) {
+                    if (es.st_nlink > 1 && !DuFirstLink(st, (unsigned long long)es.st_dev, (unsigned long long)es.st_ino)) {
+                        st->links++;
+                        return;
+                    }
+                    logical += (unsigned long long)es.st_size;
+                    allocated += (unsigned long long)es.st_blocks * 512;
+                    files++;
+                    return;
+                }
+            }
+            n->pending++;
+            n->openers++;
+            DuPush(st, self, new DuNode(n, name));
+        };
+
+#ifdef __linux__
+        for (;;) {
+            long got = syscall(SYS_getdents64, n->fd, buf.data(), buf.size());
+            if (got <= 0) {
+                if (got < 0) DuError(st, n, (unsigned long long)errno);
+                break;
+            }
+            for (long off = 0; off < got;) {
+                const DuDirent64* d = (const DuDirent64*)(buf.data() + off);
+                entry(d->d_name, d->d_type == DT_DIR ? 1 : d->d_type == DT_UNKNOWN ? -1 : 0);
+                off += d->d_reclen;
+            }
+        }
+#else
+        (void)buf;
+        int dfd = dup(n->fd);        // closedir closes its fd; n->fd must outlive it
+        DIR* dir = dfd >= 0 ? fdopendir(dfd) : NULL;
+        if (dir == NULL) {
+            DuError(st, n, (unsigned long long)errno);
+            if (dfd >= 0) close(dfd);
+        }
+        else {
+            while (struct dirent* d = readdir(dir)) entry(d->d_name, -1);
+            closedir(dir);
+        }
+#endif
+    }
+    n->logical += logical;
+    n->allocated += allocated;
+    n->files += files;
+    DuRelease(n);
+    if (--n->pending == 0) DuFinish(st, n);
+}
+#else
+// [113] One directory, Win32: list it by path; sizes come with the listing.
+static void DuProcess(DuState* st, int self, DuNode* n, std::vector<char>& buf) {
+    (void)buf;
+    unsigned long long logical = 0, files = 0;
+    TString path = DuPath(n);
+    WIN32_FIND_DATA fd;
+    HANDLE h = FindFirstFileEx((path + _T("\\*")).c_str(), FindExInfoBasic, &fd, FindExSearchNameMatch, NULL,
+                               FIND_FIRST_EX_LARGE_FETCH);
+    if (h == INVALID_HANDLE_VALUE) DuError(st, n, GetLastError());
+    else {
+        n->dirs = 1;
+        do {
+            const TCHAR* name = fd.cFileName;
+            if (name[0] == _T('.') && (name[1] == 0 || (name[1] == _T('.') && name[2] == 0))) continue;
+            if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !(fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                n->pending++;
+                DuPush(st, self, new DuNode(n, name));
+            }
+            else {
+                logical += ((unsigned long long)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+                files++;
+            }
+        } while (FindNextFile(h, &fd));
+        FindClose(h);
+    }
+    n->logical += logical;
+    n->allocated += logical;
+    n->files += files;
+    if (--n->pending == 0) DuFinish(st, n);
+}
+#endif
+
+static void DuWorker(DuState* st, int self) {
+    std::vector<char> buf(DU_DENTS_BUF);
+    while (st->work > 0) {
+        DuNode* n = DuNext(st, self);
+        if (n == NULL) {             // others are still listing: sleep until they queue more or finish
+            std::unique_lock<std::mutex> lk(st->idleLock);
+            st->idlers++;
+            st->idle.wait(lk, [st] { return st->queued > 0 || st->work == 0; });
+            st->idlers--;
+            continue;
+        }
+        DuProcess(st, self, n, buf);
+        if (--st->work == 0) {       // the last task: wake everyone to exit
+            std::lock_guard<std::mutex> guard(st->idleLock);
+            st->idle.notify_all();
+        }
+    }
+}
+
+static TString DuSize(unsigned long long v) {
+    static const TCHAR* units[] = { _T("B"), _T("K"), _T("M"), _T("G"), _T("T"), _T("P") };
+    double d = (double)v;
+    int u = 0;
+    while (d >= 1024 && u < 5) {
+        d /= 1024;
+        u++;
+    }
+    TCHAR s[32];
+    _stprintf(s, _T("%.1f%s"), d, units[u]);
+    return s;
+}
+
+static int RunDu(const TCHAR* root, int threads, int top, bool xdev) {
+#ifndef _WIN32
+    struct rlimit rl;                // one fd per directory on the current path of each worker, and
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {   // the parents of queued ones
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+#endif
+    DuState st(threads, top, xdev);
+    TString start = root;
+    while (start.size() > 1 && start[start.size() - 1] == _T('/')) start.erase(start.size() - 1);
+    DuNode* rootNode = new DuNode(NULL, start);
+    unsigned long long logical = 0, allocated = 0, files = 0, dirs = 0;
+    rootNode->pending++;             // held until the walk is over, so the totals can be read
+    long long t0 = NowNs();
+    DuPush(&st, 0, rootNode);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) pool.push_back(std::thread(DuWorker, &st, t));
+    for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+    double secs = (NowNs() - t0) / 1e9;
+    logical = rootNode->logical;
+    allocated = rootNode->allocated;
+    files = rootNode->files;
+    dirs = rootNode->dirs;
+    if (--rootNode->pending == 0) DuFinish(&st, rootNode);
+    if (dirs == 0) return 2;         // the root itself could not be read (already reported)
+
+    _tprintf(_T("%s: %llu files, %llu directories in %.2f s with %d thread(s) (%.0f entries/s)\n"), start.c_str(),
+             files, dirs, secs, threads, secs > 0 ? (files + dirs) / secs : 0.0);
+    _tprintf(_T("  logical %s, allocated %s"), DuSize(logical).c_str(), DuSize(allocated).c_str());
+    if (logical > allocated) _tprintf(_T(" (%s in holes: sparse files)"), DuSize(logical - allocated).c_str());
+    _tprintf(_T("\n  %llu extra hard links counted once, %llu unreadable entries\n\n"),
+             (unsigned long long)st.links, (unsigned long long)st.errors);
+
+    std::sort_heap(st.heap.begin(), st.heap.end());
+    _tprintf(_T("%10s %10s %12s  %s\n"), _T("allocated"), _T("logical"), _T("files"), _T("directory"));
+    for (size_t i = 0; i < st.heap.size(); i++)
+        _tprintf(_T("%10s %10s %12llu  %s\n"), DuSize(st.heap[i].allocated).c_str(), DuSize(st.heap[i].logical).c_str(),
+                 st.heap[i].files, st.heap[i].path.c_str());
+    return st.errors > 0 ? 3 : 0;
+}
@@ -0,0 +1,288 @@
+// iobuf.h - buffer sizing policy and page-aligned buffer pool shared by the
+// src_cpp tools (cat.cpp, cipher.cpp). Header-only so each tool still builds
+// from its single .cpp file.
+//
+// Sizing: start from IOBUF_DEFAULT, then ask each end of the copy what it
+// prefers - st_blksize for files and block devices, F_GETPIPE_SZ for pipes
+// (Win32: FILE_STORAGE_INFO / GetNamedPipeInfo) - and take the larger. The
+// result is clamped to [IOBUF_MIN, IOBUF_MAX] and rounded up to whole pages.
+// A --bufsize override skips the probing but is still clamped and rounded.
+//
+// Buffers come from IoBufPool: page-aligned, allocated once, reused for
+// every file, so the per-file cost is a free-list pop instead of a stack
+// array or a malloc.
+//
+// Direct I/O (--direct): IoDirectEnable turns on O_DIRECT for an open
+// regular file so bulk copies bypass the page cache. Pool buffers are
+// page-aligned and IoBufSize sizes are whole pages, so every transfer is
+// aligned except the one that reaches an unaligned end of file; reads get a
+// short count there, and writes fail with EINVAL, which the tools answer
+// with IoDirectDisable and a buffered retry of that last piece. Where
+// O_DIRECT is refused (tmpfs, pipes, Win32 handles opened without
+// FILE_FLAG_NO_BUFFERING) IoDropBehind evicts what has already been copied
+// instead, so the cache still does not fill up with one-shot data.
+
+#ifndef IOBUF_H
+#define IOBUF_H
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+
+#define IOBUF_DEFAULT (128 << 10)
+#define IOBUF_MIN 4096
+#define IOBUF_MAX (16 << 20)
+#define IODROP_CHUNK (8ULL << 20)   // IoDropBehind works in steps of this many bytes
+#define IODIRECT_BUF (1 << 20)      // default transfer size with --direct: no readahead to lean on
+
+#ifdef _WIN32
+typedef HANDLE IoHandle;
+#else
+typedef int IoHandle;
+#endif
+
+static inline size_t IoPageSize() {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwPageSize;
+#else
+    long page = sysconf(_SC_PAGESIZE);
+    return page > 0 ? (size_t)page : 4096;
+#endif
+}
+
+static inline size_t IoRoundUp(size_t n, size_t unit) {
+    return (n + unit - 1) / unit * unit;
+}
+
+// What one end of a copy would like per call; 0 when it has no opinion.
+static inline size_t IoPreferredSize(IoHandle h) {
+#ifdef _WIN32
+    switch (GetFileType(h)) {
+    case FILE_TYPE_DISK: {
+        FILE_STORAGE_INFO fsi;
+        if (GetFileInformationByHandleEx(h, FileStorageInfo, &fsi, sizeof(fsi)))
+            return IoRoundUp(IOBUF_DEFAULT, fsi.PhysicalBytesPerSectorForPerformance);
+        return 0;
+    }
+    case FILE_TYPE_PIPE: {
+        DWORD outSize = 0, inSize = 0;
+        if (GetNamedPipeInfo(h, NULL, &outSize, &inSize, NULL))
+            return outSize > inSize ? outSize : inSize;
+        return 0;
+    }
+    default:
+        return 0;
+    }
+#else
+    struct stat st;
+    if (fstat(h, &st) != 0) return 0;
+#ifdef F_GETPIPE_SZ
+    if (S_ISFIFO(st.st_mode)) {
+        int pipeSize = fcntl(h, F_GETPIPE_SZ);
+        return pipeSize > 0 ? (size_t)pipeSize : 0;
+    }
+#endif
+    if ((S_ISREG(st.st_mode) || S_ISBLK(st.st_mode)) && st.st_blksize > 0)
+        return IoRoundUp(IOBUF_DEFAULT, (size_t)st.st_blksize);
+    return 0;
+#endif
+}
+
+// Buffer size for copying hIn to hOut. override (from --bufsize) wins when
+// non-zero. Either handle may be invalid, in which case it is not consulted.
+static inline size_t IoBufSize(IoHandle hIn, IoHandle hOut, size_t override) {
+    size_t size = override;
+    if (size == 0) {
+        size_t in = IoPreferredSize(hIn), out = IoPreferredSize(hOut);
+        size = in > out ? in : out;
+        if (size == 0) size = IOBUF_DEFAULT;
+    }
+    if (size < IOBUF_MIN) size = IOBUF_MIN;
+    if (size > IOBUF_MAX) size = IOBUF_MAX;
+    return IoRoundUp(size, IoPageSize());
+}
+
+// Parses a --bufsize value: a byte count with an optional K, M or G suffix.
+// Returns 0 for anything unparsable, which callers treat as "no override".
+// Templated on the character type so _tmain's TCHAR argv works either way.
+template <class CharT>
+static inline size_t IoParseSize(const CharT* s) {
+    unsigned long long n = 0;
+    const CharT* p = s;
+    for (; *p >= '0' && *p <= '9'; p++) n = n * 10 + (unsigned long long)(*p - '0');
+    if (p == s) return 0;
+    switch (*p) {
+    case 'k': case 'K': n <<= 10; p++; break;
+    case 'm': case 'M': n <<= 20; p++; break;
+    case 'g': case 'G': n <<= 30; p++; break;
+    default: break;
+    }
+    return *p != '\0' ? 0 : (size_t)n;
+}
+
+// Sets O_DIRECT on h; false when h is not a file or the filesystem refuses.
+static inline bool IoDirectEnable(IoHandle h) {
+#if !defined(_WIN32) && defined(O_DIRECT)
+    struct stat st;
+    if (fstat(h, &st) != 0 || !(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))) return false;
+    int flags = fcntl(h, F_GETFL);
+    return flags >= 0 && ((flags & O_DIRECT) != 0 || fcntl(h, F_SETFL, flags | O_DIRECT) == 0);
+#else
+    (void)h;
+    return false;
+#endif
+}
+
+// Clears O_DIRECT again; true if it was set, i.e. a failed transfer is
+// worth retrying buffered.
+static inline bool IoDirectDisable(IoHandle h) {
+#if !defined(_WIN32) && defined(O_DIRECT)
+    int flags = fcntl(h, F_GETFL);
+    return flags >= 0 && (flags & O_DIRECT) != 0 && fcntl(h, F_SETFL, flags & ~O_DIRECT) == 0;
+#else
+    (void)h;
+    return false;
+#endif
+}
+
+// True while O_DIRECT is set on h, i.e. no transfer has fallen back yet.
+static inline bool IoDirectActive(IoHandle h) {
+#if !defined(_WIN32) && defined(O_DIRECT)
+    int flags = fcntl(h, F_GETFL);
+    return flags >= 0 && (flags & O_DIRECT) != 0;
+#else
+    (void)h;
+    return false;
+#endif
+}
+
+// Current file offset, or 0 where there is none (pipes).
+static inline unsigned long long IoTell(IoHandle h) {
+#ifdef _WIN32
+    LARGE_INTEGER zero, pos;
+    zero.QuadPart = 0;
+    return SetFilePointerEx(h, zero, &pos, FILE_CURRENT) ? (unsigned long long)pos.QuadPart : 0;
+#else
+    off_t pos = lseek(h, 0, SEEK_CUR);
+    return pos > 0 ? (unsigned long long)pos : 0;
+#endif
+}
+
+// Progress of IoDropBehind on one handle: [start, dropped) has been
+// evicted, and for an output [dropped, queued) has been handed to writeback.
+struct IoDropState {
+    unsigned long long dropped, queued;
+    explicit IoDropState(unsigned long long start = 0) : dropped(start), queued(start) {}
+};
+
+// Bytes up to offset to have been read from (written = false) or written to
+// h. Every IODROP_CHUNK, or on the final call, evict them from the page
+// cache. Clean pages go at once; written pages are dirty, so they are queued
+// for writeback one step and evicted the next, after waiting for it. A
+// no-op on a direct handle (nothing cached), a pipe, and on Win32.
+static inline void IoDropBehind(IoHandle h, IoDropState* st, unsigned long long to, bool written, bool final) {
+#ifndef _WIN32
+    if (to <= st->queued || (!final && to - st->queued < IODROP_CHUNK)) return;
+    unsigned long long from = st->dropped - st->dropped % IoPageSize(); // fadvise keeps partial pages
+    if (!written) {
+        posix_fadvise(h, (off_t)from, (off_t)(to - from), POSIX_FADV_DONTNEED);
+        st->dropped = st->queued = to;
+        return;
+    }
+#ifdef SYNC_FILE_RANGE_WRITE
+    sync_file_range(h, (off_t)st->queued, (off_t)(to - st->queued), SYNC_FILE_RANGE_WRITE);
+    unsigned long long ready = final ? to : st->queued;
+    if (ready > st->dropped)                     // a length of 0 would mean "to end of file"
+        sync_file_range(h, (off_t)st->dropped, (off_t)(ready - st->dropped),
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+    unsigned long long ready = to;
+    if (final) fdatasync(h);
+    else return;
+#endif
+    if (ready > st->dropped)
+        posix_fadvise(h, (off_t)from, (off_t)(ready - from), POSIX_FADV_DONTNEED);
+    st->dropped = ready;
+    st->queued = to;
+#else
+    (void)h; (void)st; (void)to; (void)written; (void)final;
+#endif
+}
+
+// Thread-safe pool of page-aligned buffers. Get() reuses a free buffer of
+// at least the requested size, otherwise allocates one; Put() returns it.
+// Everything is released when the pool is destroyed.
+class IoBufPool {
+public:
+    IoBufPool() {}
+    ~IoBufPool() {
+        for (size_t i = 0; i < all.size(); i++) Free(all[i].ptr);
+    }
+
+    unsigned char* Get(size_t size) {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (size_t i = 0; i < spare.size(); i++) {
+            if (spare[i].size >= size) {
+                unsigned char* p = spare[i].ptr;
+                spare.erase(spare.begin() + i);
+                return p;
+            }
+        }
+        size = IoRoundUp(size, IoPageSize());
+        unsigned char* p = Alloc(size);
+        if (p != NULL) all.push_back(Buf{ p, size });
+        return p;
+    }
+
+    void Put(unsigned char* p) {
+        if (p == NULL) return;
+        std::lock_guard<std::mutex> lock(mtx);
+        for (size_t i = 0; i < all.size(); i++) {
+            if (all[i].ptr == p) {
+                spare.push_back(all[i]);
+                return;
+            }
+        }
+    }
+
+private:
+    struct Buf {
+        unsigned char* ptr;
+        size_t size;
+    };
+
+    static unsigned char* Alloc(size_t size) {
+#ifdef _WIN32
+        return (unsigned char*)VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+        void* p;
+        return posix_memalign(&p, IoPageSize(), size) == 0 ? (unsigned char*)p : NULL;
+#endif
+    }
+
+    static void Free(unsigned char* p) {
+#ifdef _WIN32
+        VirtualFree(p, 0, MEM_RELEASE);
+#else
+        free(p);
+#endif
+    }
+
+    IoBufPool(const IoBufPool&);
+    IoBufPool& operator=(const IoBufPool&);
+
+    std::vector<Buf> all, spare;
+    std::mutex mtx;
+};
+
+#endif
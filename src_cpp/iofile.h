@@ -0,0 +1,531 @@
+// iofile.h - portable file I/O shared by the src_cpp tools (cat.cpp,
+// cipher.cpp, freespace.cpp). Header-only, like iobuf.h, so each tool still
+// builds from its single .cpp file; the backend is picked at compile time:
+// Win32 handles on _WIN32, file descriptors everywhere else.
+//
+//  - The Win32 vocabulary the tools are written in (BOOL, DWORD, BYTE,
+//    TCHAR, _T, _tmain, ...), defined for POSIX builds so tool code does not
+//    fork on types.
+//  - IoFile: RAII owner of one IoHandle, closed by the destructor.
+//  - IoRead/IoWriteSome/IoWrite on the current offset, IoReadAt/IoWriteAt
+//    positional (pread/pwrite, OVERLAPPED offsets), all retrying EINTR and
+//    falling back from O_DIRECT to buffered when a transfer is misaligned
+//    (see iobuf.h).
+//  - Size and allocated size, truncate/extend, sync, rename, delete,
+//    identity and free-space queries.
+//  - IoBuf: RAII lease of an IoBufPool buffer.
+//  - IoLastError/IoErrorText/IoReportError: one error code type
+//    (GetLastError() or errno), its system text, and one
+//    "ERROR: msg (system text)" format on stderr.
+
+#ifndef IOFILE_H
+#define IOFILE_H
+
+#ifdef _WIN32
+#include <windows.h>
+#include <tchar.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "iobuf.h"
+
+#ifndef _WIN32
+typedef int HANDLE;
+typedef int BOOL;
+typedef unsigned int DWORD;
+typedef unsigned char BYTE;
+typedef char TCHAR;
+typedef const char* LPCSTR;
+typedef const char* LPCTSTR;
+typedef char* LPTSTR;
+#define TRUE 1
+#define FALSE 0
+#define INVALID_HANDLE_VALUE (-1)
+#define _T(x) x
+#define _tmain main
+#define _tcscmp strcmp
+#define _tcsncmp strncmp
+#define _ttoi atoi
+#define _tstoi64 atoll
+#define _tprintf printf
+#define _tscanf scanf
+#define _stprintf sprintf
+#define _ftprintf fprintf
+#define _tfopen fopen
+#endif
+
+#ifdef _WIN32
+typedef DWORD IoError;
+#else
+typedef int IoError;
+#endif
+
+enum IoMode {
+    IO_READ,        // existing file, read-only
+    IO_CREATE,      // create or truncate, write-only; others may open it for writing too
+    IO_WRITE,       // existing file, write-only, shared the same way (parallel writers)
+    IO_UPDATE,      // existing file, read-write, exclusive
+    IO_CREATE_NEW   // new file, read-write, exclusive; fails if it exists
+};
+
+static inline IoError IoLastError() {
+#ifdef _WIN32
+    return GetLastError();
+#else
+    return errno;
+#endif
+}
+
+static inline IoHandle IoStdin() {
+#ifdef _WIN32
+    return GetStdHandle(STD_INPUT_HANDLE);
+#else
+    return STDIN_FILENO;
+#endif
+}
+
+static inline IoHandle IoStdout() {
+#ifdef _WIN32
+    return GetStdHandle(STD_OUTPUT_HANDLE);
+#else
+    return STDOUT_FILENO;
+#endif
+}
+
+#ifdef _WIN32
+static inline IoHandle IoOpenHandle(const char* path, IoMode mode) {
+    static const DWORD access[] = { GENERIC_READ, GENERIC_WRITE, GENERIC_WRITE,
+                                    GENERIC_READ | GENERIC_WRITE, GENERIC_READ | GENERIC_WRITE };
+    static const DWORD share[] = { FILE_SHARE_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                   FILE_SHARE_READ | FILE_SHARE_WRITE, 0, 0 };
+    static const DWORD disposition[] = { OPEN_EXISTING, CREATE_ALWAYS, OPEN_EXISTING, OPEN_EXISTING, CREATE_NEW };
+    return CreateFileA(path, access[mode], share[mode], NULL, disposition[mode], FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+static inline IoHandle IoOpenHandle(const wchar_t* path, IoMode mode) {
+    static const DWORD access[] = { GENERIC_READ, GENERIC_WRITE, GENERIC_WRITE,
+                                    GENERIC_READ | GENERIC_WRITE, GENERIC_READ | GENERIC_WRITE };
+    static const DWORD share[] = { FILE_SHARE_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                   FILE_SHARE_READ | FILE_SHARE_WRITE, 0, 0 };
+    static const DWORD disposition[] = { OPEN_EXISTING, CREATE_ALWAYS, OPEN_EXISTING, OPEN_EXISTING, CREATE_NEW };
+    return CreateFileW(path, access[mode], share[mode], NULL, disposition[mode], FILE_ATTRIBUTE_NORMAL, NULL);
+}
+#else
+static inline IoHandle IoOpenHandle(const char* path, IoMode mode) {
+    static const int flags[] = { O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY, O_RDWR, O_RDWR | O_CREAT | O_EXCL };
+    for (;;) {
+        int fd = open(path, flags[mode] | O_CLOEXEC, 0666);
+        if (fd >= 0 || errno != EINTR) return fd;
+    }
+}
+#endif
+
+static inline bool IoClose(IoHandle h) {
+#ifdef _WIN32
+    return CloseHandle(h) != 0;
+#else
+    return close(h) == 0;
+#endif
+}
+
+// Owns one handle. Not copyable; Release() hands the handle over instead.
+class IoFile {
+public:
+    IoFile() : h(INVALID_HANDLE_VALUE) {}
+    explicit IoFile(IoHandle handle) : h(handle) {}
+    ~IoFile() { Close(); }
+
+    template <class CharT>
+    bool Open(const CharT* path, IoMode mode) {
+        Close();
+        h = IoOpenHandle(path, mode);
+        return h != INVALID_HANDLE_VALUE;
+    }
+
+    // Closes now, reporting failure (the destructor cannot).
+    bool Close() {
+        if (h == INVALID_HANDLE_VALUE) return true;
+        bool ok = IoClose(h);
+        h = INVALID_HANDLE_VALUE;
+        return ok;
+    }
+
+    IoHandle Release() {
+        IoHandle r = h;
+        h = INVALID_HANDLE_VALUE;
+        return r;
+    }
+
+    IoHandle Get() const { return h; }
+    bool Valid() const { return h != INVALID_HANDLE_VALUE; }
+
+private:
+    IoFile(const IoFile&);
+    IoFile& operator=(const IoFile&);
+
+    IoHandle h;
+};
+
+// One read at the current offset; *got == 0 at end of input. A closed
+// Win32 pipe is end of input too, not an error.
+static inline bool IoRead(IoHandle h, void* buf, size_t n, size_t* got) {
+#ifdef _WIN32
+    DWORD r = 0;
+    BOOL ok = ReadFile(h, buf, (DWORD)n, &r, NULL);
+    *got = r;
+    return ok || GetLastError() == ERROR_BROKEN_PIPE;
+#else
+    for (;;) {
+        ssize_t r = read(h, buf, n);
+        if (r >= 0) {
+            *got = (size_t)r;
+            return true;
+        }
+        *got = 0;
+        if (errno == EINTR || (errno == EINVAL && IoDirectDisable(h))) continue;
+        return false;
+    }
+#endif
+}
+
+// One write at the current offset; *put may be short.
+static inline bool IoWriteSome(IoHandle h, const void* buf, size_t n, size_t* put) {
+#ifdef _WIN32
+    DWORD w = 0;
+    BOOL ok = WriteFile(h, buf, (DWORD)n, &w, NULL);
+    *put = w;
+    return ok != 0;
+#else
+    for (;;) {
+        ssize_t w = write(h, buf, n);
+        if (w >= 0) {
+            *put = (size_t)w;
+            return true;
+        }
+        *put = 0;
+        if (errno == EINTR || (errno == EINVAL && IoDirectDisable(h))) continue;
+        return false;
+    }
+#endif
+}
+
+// All n bytes, or false.
+static inline bool IoWrite(IoHandle h, const void* buf, size_t n) {
+    const unsigned char* p = (const unsigned char*)buf;
+    while (n > 0) {
+        size_t put;
+        if (!IoWriteSome(h, p, n, &put) || put == 0) return false;
+        p += put;
+        n -= put;
+    }
+    return true;
+}
+
+// Positional read of up to n bytes at off; fewer only at end of file. No
+// shared file pointer is involved, so threads can share a file.
+static inline bool IoReadAt(IoHandle h, void* buf, size_t n, unsigned long long off, size_t* got) {
+    unsigned char* p = (unsigned char*)buf;
+    *got = 0;
+    while (*got < n) {
+#ifdef _WIN32
+        OVERLAPPED ov = { 0 };
+        DWORD r = 0;
+        ov.Offset = (DWORD)(off + *got);
+        ov.OffsetHigh = (DWORD)((off + *got) >> 32);
+        if (!ReadFile(h, p + *got, (DWORD)(n - *got), &r, &ov)) return GetLastError() == ERROR_HANDLE_EOF;
+#else
+        ssize_t r = pread(h, p + *got, n - *got, (off_t)(off + *got));
+        if (r < 0) {
+            if (errno == EINTR || (errno == EINVAL && IoDirectDisable(h))) continue;
+            return false;
+        }
+#endif
+        if (r == 0) break;
+        *got += (size_t)r;
+    }
+    return true;
+}
+
+static inline bool IoWriteAt(IoHandle h, const void* buf, size_t n, unsigned long long off) {
+    const unsigned char* p = (const unsigned char*)buf;
+    size_t done = 0;
+    while (done < n) {
+#ifdef _WIN32
+        OVERLAPPED ov = { 0 };
+        DWORD w = 0;
+        ov.Offset = (DWORD)(off + done);
+        ov.OffsetHigh = (DWORD)((off + done) >> 32);
+        if (!WriteFile(h, p + done, (DWORD)(n - done), &w, &ov) || w == 0) return false;
+#else
+        ssize_t w = pwrite(h, p + done, n - done, (off_t)(off + done));
+        if (w < 0) {
+            if (errno == EINTR || (errno == EINVAL && IoDirectDisable(h))) continue;
+            return false;
+        }
+        if (w == 0) { // No progress and no error: fail rather than spin.
+            errno = EIO;
+            return false;
+        }
+#endif
+        done += (size_t)w;
+    }
+    return true;
+}
+
+// Length of a regular (disk) file; false for pipes, ttys and devices.
+static inline bool IoSize(IoHandle h, unsigned long long* size) {
+#ifdef _WIN32
+    LARGE_INTEGER li;
+    if (GetFileType(h) != FILE_TYPE_DISK || !GetFileSizeEx(h, &li)) return false;
+    *size = (unsigned long long)li.QuadPart;
+    return true;
+#else
+    struct stat st;
+    if (fstat(h, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    *size = (unsigned long long)st.st_size;
+    return true;
+#endif
+}
+
+// Truncate or extend to size. Extending leaves a hole where the filesystem
+// supports sparse files.
+static inline bool IoSetSize(IoHandle h, unsigned long long size) {
+#ifdef _WIN32
+    LARGE_INTEGER li;
+    li.QuadPart = (LONGLONG)size;
+    return SetFilePointerEx(h, li, NULL, FILE_BEGIN) && SetEndOfFile(h);
+#else
+    return ftruncate(h, (off_t)size) == 0;
+#endif
+}
+
+// Bytes the filesystem has actually allocated to the file (st_blocks on
+// POSIX, AllocationSize on Win32). Less than IoSize for a sparse file.
+static inline bool IoAllocatedSize(IoHandle h, unsigned long long* bytes) {
+#ifdef _WIN32
+    FILE_STANDARD_INFO info;
+    if (!GetFileInformationByHandleEx(h, FileStandardInfo, &info, sizeof(info))) return false;
+    *bytes = (unsigned long long)info.AllocationSize.QuadPart;
+#else
+    struct stat st;
+    if (fstat(h, &st) != 0) return false;
+    *bytes = (unsigned long long)st.st_blocks * 512;    // st_blocks is in 512-byte units everywhere
+#endif
+    return true;
+}
+
+// Data and metadata on stable storage.
+static inline bool IoSync(IoHandle h) {
+#ifdef _WIN32
+    return FlushFileBuffers(h) != 0;
+#else
+    return fsync(h) == 0;
+#endif
+}
+
+// Data (and the size needed to read it back) on stable storage; the rest of
+// the metadata may follow lazily. Win32 has no such split.
+static inline bool IoSyncData(IoHandle h) {
+#ifdef _WIN32
+    return FlushFileBuffers(h) != 0;
+#else
+    return fdatasync(h) == 0;
+#endif
+}
+
+static inline bool IoExists(const char* path) {
+#ifdef _WIN32
+    return GetFileAttributesA(path) != INVALID_FILE_ATTRIBUTES;
+#else
+    struct stat st;
+    return stat(path, &st) == 0;
+#endif
+}
+
+// Size by name, without opening; false when it cannot be had.
+static inline bool IoPathSize(const char* path, unsigned long long* size) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &fad)) return false;
+    *size = ((unsigned long long)fad.nFileSizeHigh << 32) | fad.nFileSizeLow;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+    *size = (unsigned long long)st.st_size;
+#endif
+    return true;
+}
+
+static inline bool IoDelete(const char* path) {
+#ifdef _WIN32
+    return DeleteFileA(path) != 0;
+#else
+    return unlink(path) == 0;
+#endif
+}
+
+#ifdef _WIN32
+static inline bool IoDelete(const wchar_t* path) {
+    return DeleteFileW(path) != 0;
+}
+#endif
+
+// Atomically replace to with from. Win32 writes the rename through; POSIX
+// callers that need it durable follow with IoSyncDirOf(to).
+static inline bool IoRename(const char* from, const char* to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+// fsync the directory holding path, so a create or rename in it survives a
+// crash. Nothing to do on Win32.
+static inline bool IoSyncDirOf(const char* path) {
+#ifdef _WIN32
+    (void)path;
+    return true;
+#else
+    std::string dir(path);
+    size_t slash = dir.find_last_of('/');
+    dir = slash == std::string::npos ? "." : slash == 0 ? "/" : dir.substr(0, slash);
+    int h = open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+    if (h < 0) return false;
+    bool ok = fsync(h) == 0;
+    close(h);
+    return ok;
+#endif
+}
+
+// Same underlying file (hard links, "./x" vs "x")? False when either is missing.
+static inline bool IoSameFile(const char* a, const char* b) {
+#ifdef _WIN32
+    BY_HANDLE_FILE_INFORMATION ia, ib;
+    HANDLE ha = CreateFileA(a, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    HANDLE hb = CreateFileA(b, 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    bool same = ha != INVALID_HANDLE_VALUE && hb != INVALID_HANDLE_VALUE
+        && GetFileInformationByHandle(ha, &ia) && GetFileInformationByHandle(hb, &ib)
+        && ia.dwVolumeSerialNumber == ib.dwVolumeSerialNumber
+        && ia.nFileIndexHigh == ib.nFileIndexHigh && ia.nFileIndexLow == ib.nFileIndexLow;
+    if (ha != INVALID_HANDLE_VALUE) CloseHandle(ha);
+    if (hb != INVALID_HANDLE_VALUE) CloseHandle(hb);
+    return same;
+#else
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
+}
+
+static inline unsigned long IoProcessId() {
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return (unsigned long)getpid();
+#endif
+}
+
+// Space on the volume holding path (NULL: the current directory): total
+// size, free space, and the part of it available to this user (quotas,
+// root reserve).
+struct IoSpace {
+    unsigned long long total, free, avail;
+};
+
+static inline bool IoDiskSpace(const char* path, IoSpace* sp) {
+#ifdef _WIN32
+    ULARGE_INTEGER avail, total, free;
+    if (!GetDiskFreeSpaceExA(path, &avail, &total, &free)) return false;
+    sp->total = total.QuadPart;
+    sp->free = free.QuadPart;
+    sp->avail = avail.QuadPart;
+#else
+    struct statvfs vfs;
+    if (statvfs(path != NULL ? path : ".", &vfs) != 0) return false;
+    sp->total = (unsigned long long)vfs.f_blocks * vfs.f_frsize;
+    sp->free = (unsigned long long)vfs.f_bfree * vfs.f_frsize;
+    sp->avail = (unsigned long long)vfs.f_bavail * vfs.f_frsize;
+#endif
+    return true;
+}
+
+#ifdef _WIN32
+static inline bool IoDiskSpace(const wchar_t* path, IoSpace* sp) {
+    ULARGE_INTEGER avail, total, free;
+    if (!GetDiskFreeSpaceExW(path, &avail, &total, &free)) return false;
+    sp->total = total.QuadPart;
+    sp->free = free.QuadPart;
+    sp->avail = avail.QuadPart;
+    return true;
+}
+#endif
+
+// Lease of one pool buffer, returned when the lease goes out of scope.
+class IoBuf {
+public:
+    IoBuf(IoBufPool& pool, size_t size) : pool(pool), p(pool.Get(size)), n(size) {}
+    ~IoBuf() { pool.Put(p); }
+
+    unsigned char* Get() const { return p; }
+    size_t Size() const { return n; }
+    bool Valid() const { return p != NULL; }
+
+private:
+    IoBuf(const IoBuf&);
+    IoBuf& operator=(const IoBuf&);
+
+    IoBufPool& pool;
+    unsigned char* p;
+    size_t n;
+};
+
+// The system's text for err, without a trailing newline.
+static inline std::string IoErrorText(IoError err) {
+#ifdef _WIN32
+    char* text = NULL;
+    FormatMessageA(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                   NULL, err, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPSTR)&text, 0, NULL);
+    size_t len = text != NULL ? strlen(text) : 0;
+    while (len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r')) text[--len] = '\0';
+    std::string s(text != NULL ? text : "unknown error");
+    LocalFree(text);
+    return s;
+#else
+    return strerror(err);
+#endif
+}
+
+// "ERROR: msg" on stderr, followed by the system's text for err when
+// showErr is set. The one error format for every tool.
+static inline void IoReportError(const char* msg, IoError err, bool showErr) {
+    fprintf(stderr, "ERROR: %s", msg);
+    if (showErr) fprintf(stderr, " (%s)", IoErrorText(err).c_str());
+    fprintf(stderr, "\n");
+}
+
+#ifdef _WIN32
+static inline void IoReportError(const wchar_t* msg, IoError err, bool showErr) {
+    fwprintf(stderr, L"ERROR: %ls", msg);
+    if (showErr) {
+        wchar_t* text = NULL;
+        FormatMessageW(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,
+                       NULL, err, MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT), (LPWSTR)&text, 0, NULL);
+        size_t len = text != NULL ? wcslen(text) : 0;
+        while (len > 0 && (text[len - 1] == L'\n' || text[len - 1] == L'\r')) text[--len] = L'\0';
+        fwprintf(stderr, L" (%ls)", text != NULL ? text : L"unknown error");
+        LocalFree(text);
+    }
+    fwprintf(stderr, L"\n");
+}
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+// linereader.h - line-at-a-time input without a copy or an allocation per
+// line, for the src_cpp tools that read names and records from stdin.
+// Header-only, like iobuf.h; needs C++17 for std::string_view.
+//
+// LineReader reads its handle in large blocks (IoRead, LINEREADER_BUF at a
+// time) and finds line ends with memchr, which libc vectorizes. Next()
+// hands out each line as a string_view into the block, without its '\n',
+// so a line costs one memchr and no copy. The view stays valid until the
+// next call to Next().
+//
+// A line that runs off the end of the block is not copied out piece by
+// piece: the unread tail is moved to the front of the buffer and the rest
+// of the line is read in after it, so every line handed out is contiguous.
+// The search for its '\n' resumes where the last one stopped, so a long
+// line arriving in short reads (a pipe) is still scanned only once.
+// A line longer than the whole buffer doubles the buffer, so one huge line
+// costs memory once instead of a reallocation per read.
+//
+// Semantics match std::getline: "a\nb" and "a\nb\n" are both two lines,
+// an empty input is none, '\r' is kept. Next() returns false at the end of
+// input or on a read error; Failed() tells the two apart.
+
+#ifndef LINEREADER_H
+#define LINEREADER_H
+
+#include <string.h>
+#include <memory>
+#include <string_view>
+
+#include "iofile.h"
+
+#define LINEREADER_BUF (1 << 20)
+
+class LineReader {
+public:
+    explicit LineReader(IoHandle h, size_t size = LINEREADER_BUF)
+        : h(h), buf(new char[size]), cap(size), pos(0), scan(0), end(0), eof(false), failed(false) {}
+
+    bool Next(std::string_view* line) {
+        for (;;) {
+            const char* nl = (const char*)memchr(buf.get() + scan, '\n', end - scan);
+            if (nl != NULL) {
+                size_t len = (size_t)(nl - (buf.get() + pos));
+                *line = std::string_view(buf.get() + pos, len);
+                pos += len + 1;
+                scan = pos;
+                return true;
+            }
+            scan = end;                      // no '\n' in [pos, end): never search it again
+            if (eof) {                       // last line had no '\n'
+                if (pos == end) return false;
+                *line = std::string_view(buf.get() + pos, end - pos);
+                pos = scan = end;
+                return true;
+            }
+            Fill();
+        }
+    }
+
+    bool Failed() const { return failed; }
+
+private:
+    // Keep the partial line, make room after it, read once. A short read is
+    // returned as is, so a pipe or terminal is never waited on to fill the
+    // whole buffer.
+    void Fill() {
+        size_t tail = end - pos;
+        if (pos > 0) {
+            memmove(buf.get(), buf.get() + pos, tail);
+            scan -= pos;
+            pos = 0;
+            end = tail;
+        }
+        if (end == cap) {
+            std::unique_ptr<char[]> bigger(new char[cap * 2]);
+            memcpy(bigger.get(), buf.get(), end);
+            buf.swap(bigger);
+            cap *= 2;
+        }
+        size_t got;
+        if (!IoRead(h, buf.get() + end, cap - end, &got)) failed = true;
+        if (got == 0) eof = true;
+        end += got;
+    }
+
+    LineReader(const LineReader&);
+    LineReader& operator=(const LineReader&);
+
+    IoHandle h;
+    std::unique_ptr<char[]> buf;
+    size_t cap, pos, scan, end;                // scan: where the search for '\n' resumes
+    bool eof, failed;
+};
+
+#endif
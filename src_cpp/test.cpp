@@ -1,10 +1,214 @@
+// Line-input benchmark for linereader.h (C++17: g++ -std=c++17 -O2).
+//
+// With no arguments it is still the greeting: reads a name from stdin.
+//
+//   test --read=getline|getline-nosync|linereader < FILE
+//       read stdin line by line one way and print "lines bytes hash", so the
+//       methods can be checked against each other:
+//         getline         std::getline(std::cin, s), iostreams synced with stdio
+//         getline-nosync  the same after std::ios::sync_with_stdio(false)
+//         linereader      LineReader on the stdin handle, string_view lines
+//   test --bench [--size=MB] [--dir=DIR] [--reps=N]       (POSIX only: fork/exec)
+//       generate --size MB (default 2048) of text in DIR (default /tmp) and
+//       time "test --read=..." on it for each method, best of --reps (default
+//       1). Each method runs in its own process because sync_with_stdio has
+//       to be chosen before the first read. Line lengths vary from 0 to 255
+//       bytes, with a 4 MB line every 1 GB to cross buffer boundaries and
+//       force LineReader's buffer to grow.
+
+#include <chrono>
 #include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
+#include <string_view>
+#include <vector>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "linereader.h"
 
-int main() {
-    std::string name;
-    std::cout << "Enter your name: ";
-    std::getline(std::cin, name);
-    std::cout << "Hello, " << name << "!\n";
+struct LineStats {
+    unsigned long long lines, bytes, hash;
+    void Add(const char* p, size_t n) {
+        lines++;
+        bytes += n;
+        hash = hash * 1099511628211ULL ^ (n > 0 ? (unsigned char)p[0] + ((unsigned long long)(unsigned char)p[n - 1] << 8) : 0) ^ n;
+    }
+};
+
+static int ReadStdin(const std::string& method) {
+    LineStats st = { 0, 0, 14695981039346656037ULL };
+    if (method == "linereader") {
+        LineReader in(IoStdin());
+        std::string_view line;
+        while (in.Next(&line)) st.Add(line.data(), line.size());
+        if (in.Failed()) {
+            fprintf(stderr, "Read error\n");
+            return 1;
+        }
+    }
+    else if (method == "getline" || method == "getline-nosync") {
+        if (method == "getline-nosync") std::ios::sync_with_stdio(false);
+        std::string line;
+        while (std::getline(std::cin, line)) st.Add(line.data(), line.size());
+    }
+    else {
+        fprintf(stderr, "Unknown --read method: %s\n", method.c_str());
+        return 1;
+    }
+    printf("%llu %llu %llx\n", st.lines, st.bytes, st.hash);
     return 0;
 }
+
+#ifndef _WIN32
+static bool MakeText(const std::string& path, long long bytes) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    std::vector<char> block(1 << 20);
+    unsigned int x = 2463534242u;                   // xorshift32, as bench.cpp
+    long long written = 0, nextLong = 1LL << 29;
+    while (written < bytes) {
+        size_t n = 0;
+        while (n + 257 < block.size()) {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            size_t len = x & 0xFF;
+            for (size_t i = 0; i < len; i++) block[n + i] = (char)('!' + ((x >> 8) + i * 7) % 94);
+            n += len;
+            block[n++] = '\n';
+        }
+        if (fwrite(block.data(), 1, n, f) != n) { fclose(f); return false; }
+        written += (long long)n;
+        if (written >= nextLong) {                  // one 4 MB line, then back to short ones
+            std::vector<char> big(4 << 20, 'L');
+            big.back() = '\n';
+            if (fwrite(big.data(), 1, big.size(), f) != big.size()) { fclose(f); return false; }
+            written += (long long)big.size();
+            nextLong += 1LL << 30;
+        }
+    }
+    return fclose(f) == 0;
+}
+
+// Run "self --read=method" with path as its stdin and return what it printed,
+// or "" if it failed. No shell: path goes to open(), never through sh -c.
+static std::string RunCapture(const char* self, const char* method, const std::string& path, double* secs) {
+    auto t0 = std::chrono::steady_clock::now();
+    std::string out, arg = std::string("--read=") + method;
+    int in = open(path.c_str(), O_RDONLY), fds[2] = { -1, -1 };
+    pid_t pid = in >= 0 && pipe(fds) == 0 ? fork() : -1;
+    if (pid == 0) {
+        dup2(in, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        close(in);
+        close(fds[0]);
+        close(fds[1]);
+        execlp(self, self, arg.c_str(), (char*)NULL);   // PATH lookup, as the shell did
+        _exit(127);
+    }
+    if (fds[1] >= 0) close(fds[1]);
+    if (pid > 0) {
+        char buf[256];
+        ssize_t n;
+        while ((n = read(fds[0], buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR))
+            if (n > 0) out.append(buf, (size_t)n);
+        int status = 0;
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) out.clear();
+    }
+    if (fds[0] >= 0) close(fds[0]);
+    if (in >= 0) close(in);
+    *secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return out;
+}
+
+static void WarmCache(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return;
+    std::vector<char> block(1 << 20);
+    while (fread(block.data(), 1, block.size(), f) == block.size()) {}
+    fclose(f);
+}
+
+static int Bench(const char* self, long long sizeMB, const std::string& dir, int reps) {
+    const std::string path = dir + "/test_lines.txt";
+    printf("Generating %lld MB of text in %s\n", sizeMB, path.c_str());
+    if (!MakeText(path, sizeMB << 20)) {
+        printf("Cannot create %s\n", path.c_str());
+        return 1;
+    }
+    WarmCache(path);
+
+    printf("%-16s %10s %10s %12s %9s\n", "method", "best s", "MB/s", "Mlines/s", "speedup");
+    std::string expect;
+    double base = 0;
+    int rc = 0;
+    for (const char* method : { "getline", "getline-nosync", "linereader" }) {
+        double best = -1;
+        std::string got;
+        for (int r = 0; r < reps; r++) {
+            double s;
+            got = RunCapture(self, method, path, &s);
+            if (got.empty()) break;
+            if (best < 0 || s < best) best = s;
+        }
+        if (got.empty()) {
+            printf("%-16s %10s\n", method, "failed");
+            rc = 1;
+            continue;
+        }
+        if (expect.empty()) expect = got;
+        else if (got != expect) {
+            printf("%-16s result differs: %s vs %s", method, got.c_str(), expect.c_str());
+            rc = 1;
+        }
+        unsigned long long lines = strtoull(got.c_str(), NULL, 10);
+        if (base == 0) base = best;
+        printf("%-16s %10.3f %10.1f %12.1f %8.1fx\n", method, best, (double)(sizeMB << 20) / (1 << 20) / best,
+               lines / best / 1e6, base / best);
+    }
+    if (!expect.empty()) printf("lines bytes hash: %s", expect.c_str());
+    remove(path.c_str());
+    return rc;
+}
+#endif
+
+int main(int argc, char* argv[]) {
+    if (argc == 1) {
+        LineReader in(IoStdin());
+        std::string_view name;
+        std::cout << "Enter your name: " << std::flush;
+        if (!in.Next(&name)) name = "";
+        if (!name.empty() && name.back() == '\r') name.remove_suffix(1);   // a Windows console ends lines with CRLF
+        std::cout << "Hello, " << name << "!\n";
+        return 0;
+    }
+
+    long long sizeMB = 2048;
+    std::string dir = "/tmp";
+    int reps = 1;
+    bool bench = false, bad = false;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--read=", 7) == 0) return ReadStdin(argv[i] + 7);
+        else if (strcmp(argv[i], "--bench") == 0) bench = true;
+        else if (strncmp(argv[i], "--size=", 7) == 0) sizeMB = atoll(argv[i] + 7);
+        else if (strncmp(argv[i], "--dir=", 6) == 0) dir = argv[i] + 6;
+        else if (strncmp(argv[i], "--reps=", 7) == 0) reps = atoi(argv[i] + 7);
+        else bad = true;
+    }
+    if (bad || !bench || sizeMB < 1 || reps < 1) {
+        printf("Usage: %s\n"
+               "       %s --read=getline|getline-nosync|linereader < FILE\n"
+               "       %s --bench [--size=MB] [--dir=DIR] [--reps=N]\n", argv[0], argv[0], argv[0]);
+        return 1;
+    }
+#ifdef _WIN32
+    fprintf(stderr, "--bench is POSIX only\n");
+    return 1;
+#else
+    return Bench(argv[0], sizeMB, dir, reps);
+#endif
+}
@@ -0,0 +1,413 @@
+// xform.h - vectorized byte-transform kernels for cipher.cpp.
+//
+// Caesar: out[i] = (in[i] + shift) % 256. Only the low byte of shift
+// matters - (b + shift) mod 2^32 mod 256 == (b + (shift & 0xFF)) mod 256 -
+// so every variant adds one byte k = shift & 0xFF with 8-bit wraparound,
+// which is exactly what PADDB does. Results are identical to the scalar
+// loop for any DWORD shift, including values >= 256.
+//
+// Variants: scalar, SSE2 (16 B), AVX2 (32 B), AVX-512BW (64 B). The widest
+// one the CPU *and* OS support (CPUID + XGETBV) is chosen once, on first
+// use. in and out may be the same buffer.
+//
+// Xform (bottom of the file) generalizes this into one engine behind
+// cipher.cpp's file drivers:
+//  - keyed ops (add, xor) run against a periodic key stream, so a
+//    Vigenere key of any length vectorizes exactly like a one-byte key;
+//  - fixed maps (ROT13, Atbash) are constexpr 256-entry tables built at
+//    compile time and applied with byte shuffles (VPERMI2B) on
+//    AVX-512VBMI, or one table load per byte elsewhere.
+
+#ifndef XFORM_H
+#define XFORM_H
+
+#include <stddef.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define XFORM_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define XFORM_TARGET(isa)
+#else
+#include <cpuid.h>
+#define XFORM_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+typedef void (*CaesarFn)(const unsigned char* in, unsigned char* out, size_t n, unsigned char k);
+
+enum XformIsa { XFORM_SCALAR, XFORM_SSE2, XFORM_AVX2, XFORM_AVX512BW, XFORM_AVX512VBMI };
+
+static const char* const xformIsaNames[] = { "scalar", "sse2", "avx2", "avx512bw", "avx512vbmi" };
+
+static inline void CaesarScalar(const unsigned char* in, unsigned char* out, size_t n, unsigned char k) {
+    for (size_t i = 0; i < n; i++) out[i] = (unsigned char)(in[i] + k);
+}
+
+#ifdef XFORM_X86
+XFORM_TARGET("sse2")
+static inline void CaesarSSE2(const unsigned char* in, unsigned char* out, size_t n, unsigned char k) {
+    const __m128i vk = _mm_set1_epi8((char)k);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_add_epi8(v, vk));
+    }
+    CaesarScalar(in + i, out + i, n - i, k);
+}
+
+XFORM_TARGET("avx2")
+static inline void CaesarAVX2(const unsigned char* in, unsigned char* out, size_t n, unsigned char k) {
+    const __m256i vk = _mm256_set1_epi8((char)k);
+    size_t i = 0;
+    for (; i + 128 <= n; i += 128) {             // 4x unrolled: keeps two loads + two stores in flight
+        __m256i a = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(in + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(in + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(in + i + 96));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_add_epi8(a, vk));
+        _mm256_storeu_si256((__m256i*)(out + i + 32), _mm256_add_epi8(b, vk));
+        _mm256_storeu_si256((__m256i*)(out + i + 64), _mm256_add_epi8(c, vk));
+        _mm256_storeu_si256((__m256i*)(out + i + 96), _mm256_add_epi8(d, vk));
+    }
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_add_epi8(v, vk));
+    }
+    CaesarScalar(in + i, out + i, n - i, k);
+}
+
+XFORM_TARGET("avx512f,avx512bw")
+static inline void CaesarAVX512(const unsigned char* in, unsigned char* out, size_t n, unsigned char k) {
+    const __m512i vk = _mm512_set1_epi8((char)k);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*)(in + i));
+        _mm512_storeu_si512((void*)(out + i), _mm512_add_epi8(v, vk));
+    }
+    if (i < n) {                                 // tail: one masked load/store, no scalar loop
+        __mmask64 m = _cvtu64_mask64(~0ULL >> (64 - (n - i)));
+        __m512i v = _mm512_maskz_loadu_epi8(m, (const void*)(in + i));
+        _mm512_mask_storeu_epi8((void*)(out + i), m, _mm512_add_epi8(v, vk));
+    }
+}
+
+static inline void XformCpuid(unsigned int leaf, unsigned int sub, unsigned int r[4]) {
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuidex(regs, (int)leaf, (int)sub);
+    for (int i = 0; i < 4; i++) r[i] = (unsigned int)regs[i];
+#else
+    if (!__get_cpuid_count(leaf, sub, &r[0], &r[1], &r[2], &r[3])) r[0] = r[1] = r[2] = r[3] = 0;
+#endif
+}
+
+// XCR0: which register state the OS saves on context switch.
+static inline unsigned long long XformXcr0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+#endif
+
+// Widest ISA usable on this machine.
+static inline XformIsa XformDetect() {
+#ifdef XFORM_X86
+    unsigned int r1[4], r7[4];
+    XformCpuid(0, 0, r1);
+    unsigned int maxLeaf = r1[0];
+    XformCpuid(1, 0, r1);
+    if (!(r1[3] & (1u << 26))) return XFORM_SCALAR;                 // SSE2
+    if (!(r1[2] & (1u << 27)) || maxLeaf < 7) return XFORM_SSE2;    // OSXSAVE
+    unsigned long long xcr0 = XformXcr0();
+    XformCpuid(7, 0, r7);
+    bool avx2 = (xcr0 & 0x6) == 0x6 && (r7[1] & (1u << 5));         // XMM|YMM state, AVX2
+    bool avx512 = avx2 && (xcr0 & 0xE6) == 0xE6                      // + opmask|ZMM state
+        && (r7[1] & (1u << 16)) && (r7[1] & (1u << 30));            // AVX512F, AVX512BW
+    if (avx512 && (r7[2] & (1u << 1))) return XFORM_AVX512VBMI;     // VPERMB, VPERMI2B
+    return avx512 ? XFORM_AVX512BW : avx2 ? XFORM_AVX2 : XFORM_SSE2;
+#else
+    return XFORM_SCALAR;
+#endif
+}
+
+// Kernel for a given ISA; falls back to scalar where it is not compiled in.
+static inline CaesarFn CaesarKernel(XformIsa isa) {
+#ifdef XFORM_X86
+    switch (isa) {
+    case XFORM_AVX512VBMI:
+    case XFORM_AVX512BW: return CaesarAVX512;
+    case XFORM_AVX2: return CaesarAVX2;
+    case XFORM_SSE2: return CaesarSSE2;
+    default: break;
+    }
+#else
+    (void)isa;
+#endif
+    return CaesarScalar;
+}
+
+// out[i] = (in[i] + shift) % 256 for i < n, using the best kernel.
+static inline void CaesarShift(const unsigned char* in, unsigned char* out, size_t n, unsigned int shift) {
+    static const CaesarFn kernel = CaesarKernel(XformDetect());
+    kernel(in, out, n, (unsigned char)(shift & 0xFF));
+}
+
+// ---- Keyed ops --------------------------------------------------------
+//
+// An op combines a data byte with a key byte, in scalar and in every
+// vector width. The keyed kernels are templated on it, so each op gets its
+// own fully inlined loop per ISA.
+
+struct XformAddOp {
+    static unsigned char Map(unsigned char b, unsigned char k) { return (unsigned char)(b + k); }
+    static unsigned char Inverse(unsigned char k) { return (unsigned char)(0u - k); }
+#ifdef XFORM_X86
+    XFORM_TARGET("sse2") static __m128i Vec(__m128i v, __m128i k) { return _mm_add_epi8(v, k); }
+    XFORM_TARGET("avx2") static __m256i Vec(__m256i v, __m256i k) { return _mm256_add_epi8(v, k); }
+    XFORM_TARGET("avx512f,avx512bw") static __m512i Vec(__m512i v, __m512i k) { return _mm512_add_epi8(v, k); }
+#endif
+};
+
+struct XformXorOp {
+    static unsigned char Map(unsigned char b, unsigned char k) { return (unsigned char)(b ^ k); }
+    static unsigned char Inverse(unsigned char k) { return k; }
+#ifdef XFORM_X86
+    XFORM_TARGET("sse2") static __m128i Vec(__m128i v, __m128i k) { return _mm_xor_si128(v, k); }
+    XFORM_TARGET("avx2") static __m256i Vec(__m256i v, __m256i k) { return _mm256_xor_si256(v, k); }
+    XFORM_TARGET("avx512f,avx512bw") static __m512i Vec(__m512i v, __m512i k) { return _mm512_xor_si512(v, k); }
+#endif
+};
+
+// Periodic key stream: ks[j] == key[j % keyLen] for j < period + 64, where
+// period is a multiple of both keyLen and 64. A kernel starting at phase
+// (< period) reads ks[phase..] in whole vectors and wraps by subtracting
+// period, so no vector ever straddles the wrap and no byte is gathered.
+typedef void (*KeyedFn)(const unsigned char* in, unsigned char* out, size_t n,
+                        const unsigned char* ks, size_t period, size_t phase);
+
+template <class Op>
+static inline void KeyedScalar(const unsigned char* in, unsigned char* out, size_t n,
+                               const unsigned char* ks, size_t period, size_t phase) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = Op::Map(in[i], ks[phase]);
+        if (++phase == period) phase = 0;
+    }
+}
+
+#ifdef XFORM_X86
+template <class Op>
+XFORM_TARGET("sse2")
+static inline void KeyedSSE2(const unsigned char* in, unsigned char* out, size_t n,
+                             const unsigned char* ks, size_t period, size_t phase) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i k = _mm_loadu_si128((const __m128i*)(ks + phase));
+        _mm_storeu_si128((__m128i*)(out + i), Op::Vec(v, k));
+        if ((phase += 16) >= period) phase -= period;
+    }
+    KeyedScalar<Op>(in + i, out + i, n - i, ks, period, phase);
+}
+
+template <class Op>
+XFORM_TARGET("avx2")
+static inline void KeyedAVX2(const unsigned char* in, unsigned char* out, size_t n,
+                             const unsigned char* ks, size_t period, size_t phase) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i k = _mm256_loadu_si256((const __m256i*)(ks + phase));
+        _mm256_storeu_si256((__m256i*)(out + i), Op::Vec(v, k));
+        if ((phase += 32) >= period) phase -= period;
+    }
+    KeyedScalar<Op>(in + i, out + i, n - i, ks, period, phase);
+}
+
+template <class Op>
+XFORM_TARGET("avx512f,avx512bw")
+static inline void KeyedAVX512(const unsigned char* in, unsigned char* out, size_t n,
+                               const unsigned char* ks, size_t period, size_t phase) {
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*)(in + i));
+        __m512i k = _mm512_loadu_si512((const void*)(ks + phase));
+        _mm512_storeu_si512((void*)(out + i), Op::Vec(v, k));
+        if ((phase += 64) >= period) phase -= period;
+    }
+    if (i < n) {                                 // ks has 64 spare bytes past period
+        __mmask64 m = _cvtu64_mask64(~0ULL >> (64 - (n - i)));
+        __m512i v = _mm512_maskz_loadu_epi8(m, (const void*)(in + i));
+        __m512i k = _mm512_maskz_loadu_epi8(m, (const void*)(ks + phase));
+        _mm512_mask_storeu_epi8((void*)(out + i), m, Op::Vec(v, k));
+    }
+}
+#endif
+
+template <class Op>
+static inline KeyedFn KeyedKernel(XformIsa isa) {
+#ifdef XFORM_X86
+    switch (isa) {
+    case XFORM_AVX512VBMI:
+    case XFORM_AVX512BW: return KeyedAVX512<Op>;
+    case XFORM_AVX2: return KeyedAVX2<Op>;
+    case XFORM_SSE2: return KeyedSSE2<Op>;
+    default: break;
+    }
+#else
+    (void)isa;
+#endif
+    return KeyedScalar<Op>;
+}
+
+// ---- Fixed byte maps --------------------------------------------------
+//
+// A fixed map is any Map(b) with no key; its 256-entry table is a
+// constexpr, so it is built by the compiler and lands in .rodata.
+
+struct XformLut {
+    unsigned char t[256];
+};
+
+template <class Map>
+constexpr XformLut XformMakeLut() {
+    XformLut lut = {};
+    for (int b = 0; b < 256; b++) lut.t[b] = Map::Map((unsigned char)b);
+    return lut;
+}
+
+template <class Map>
+struct XformTable {
+    static constexpr XformLut lut = XformMakeLut<Map>();
+};
+template <class Map>
+constexpr XformLut XformTable<Map>::lut;
+
+struct XformRot13Map {
+    static constexpr unsigned char Map(unsigned char b) {
+        return b >= 'a' && b <= 'z' ? (unsigned char)('a' + (b - 'a' + 13) % 26)
+             : b >= 'A' && b <= 'Z' ? (unsigned char)('A' + (b - 'A' + 13) % 26) : b;
+    }
+};
+
+struct XformAtbashMap {
+    static constexpr unsigned char Map(unsigned char b) {
+        return b >= 'a' && b <= 'z' ? (unsigned char)('z' - (b - 'a'))
+             : b >= 'A' && b <= 'Z' ? (unsigned char)('Z' - (b - 'A')) : b;
+    }
+};
+
+typedef void (*TableFn)(const unsigned char* lut, const unsigned char* in, unsigned char* out, size_t n);
+
+static inline void TableScalar(const unsigned char* lut, const unsigned char* in, unsigned char* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = lut[in[i]];
+}
+
+#ifdef XFORM_X86
+// The whole table in four registers: VPERMI2B looks up 128 entries from a
+// register pair using the low 7 bits, and bit 7 picks which pair. Without
+// VBMI the table loop stays scalar: a sixteen-way PSHUFB nibble lookup on
+// AVX2 measured no faster than one load per byte.
+XFORM_TARGET("avx512f,avx512bw,avx512vbmi")
+static inline void TableVBMI(const unsigned char* lut, const unsigned char* in, unsigned char* out, size_t n) {
+    const __m512i t0 = _mm512_loadu_si512((const void*)lut), t1 = _mm512_loadu_si512((const void*)(lut + 64));
+    const __m512i t2 = _mm512_loadu_si512((const void*)(lut + 128)), t3 = _mm512_loadu_si512((const void*)(lut + 192));
+    for (size_t i = 0; i < n; i += 64) {         // last pass masked, like CaesarAVX512's tail
+        __mmask64 m = n - i >= 64 ? ~(__mmask64)0 : _cvtu64_mask64(~0ULL >> (64 - (n - i)));
+        __m512i v = _mm512_maskz_loadu_epi8(m, (const void*)(in + i));
+        __m512i lo = _mm512_permutex2var_epi8(t0, v, t1);
+        __m512i hi = _mm512_permutex2var_epi8(t2, v, t3);
+        _mm512_mask_storeu_epi8((void*)(out + i), m, _mm512_mask_blend_epi8(_mm512_movepi8_mask(v), lo, hi));
+    }
+}
+#endif
+
+static inline TableFn TableKernel(XformIsa isa) {
+#ifdef XFORM_X86
+    switch (isa) {
+    case XFORM_AVX512VBMI: return TableVBMI;
+    default: break;
+    }
+#else
+    (void)isa;
+#endif
+    return TableScalar;
+}
+
+// ---- Engine -----------------------------------------------------------
+
+enum XformKind { XFORM_CAESAR, XFORM_XOR, XFORM_VIGENERE, XFORM_ROT13, XFORM_ATBASH };
+
+static const char* const xformKindNames[] = { "caesar", "xor", "vigenere", "rot13", "atbash" };
+
+// One configured transform. Apply() is position-aware so chunked and
+// parallel drivers can process any byte range independently: pos is the
+// offset of in[0] within the whole stream.
+class Xform {
+public:
+    Xform() : kind(XFORM_CAESAR), keyLen(1), period(0), keyed(NULL), table(NULL), lut(NULL) { key.push_back(0); }
+
+    // Caesar: key is the shift (any DWORD; only the low byte matters).
+    // Xor: key & 0xFF. Vigenere: key bytes, added position by position.
+    static Xform Caesar(unsigned int shift) { unsigned char k = (unsigned char)(shift & 0xFF); return Keyed(XFORM_CAESAR, &k, 1); }
+    static Xform Xor(unsigned int k) { unsigned char b = (unsigned char)(k & 0xFF); return Keyed(XFORM_XOR, &b, 1); }
+    static Xform Vigenere(const unsigned char* k, size_t len) { return Keyed(XFORM_VIGENERE, k, len); }
+    static Xform Rot13() { return Fixed(XFORM_ROT13, XformTable<XformRot13Map>::lut.t); }
+    static Xform Atbash() { return Fixed(XFORM_ATBASH, XformTable<XformAtbashMap>::lut.t); }
+
+    // The transform that undoes this one. Xor, ROT13 and Atbash are their
+    // own inverses; add-based kinds negate every key byte.
+    Xform Inverse() const {
+        if (kind != XFORM_CAESAR && kind != XFORM_VIGENERE) return *this;
+        std::vector<unsigned char> inv(key.size());
+        for (size_t j = 0; j < key.size(); j++) inv[j] = XformAddOp::Inverse(key[j]);
+        return Keyed(kind, inv.data(), inv.size());
+    }
+
+    XformKind Kind() const { return kind; }
+
+    void Apply(const unsigned char* in, unsigned char* out, size_t n, unsigned long long pos) const {
+        if (lut != NULL) table(lut, in, out, n);
+        else if (keyLen == 1 && kind != XFORM_XOR) CaesarShift(in, out, n, key[0]);
+        else keyed(in, out, n, ks.data(), period, (size_t)(pos % keyLen));
+    }
+
+private:
+    static Xform Keyed(XformKind kind, const unsigned char* k, size_t len) {
+        static const XformIsa isa = XformDetect();
+        Xform x;
+        x.kind = kind;
+        x.key.assign(k, k + len);
+        x.keyLen = len;
+        x.period = len;                          // lcm(len, 64)
+        while (x.period % 64 != 0) x.period += len;
+        x.ks.resize(x.period + 64);
+        for (size_t j = 0; j < x.ks.size(); j++) x.ks[j] = k[j % len];
+        x.keyed = kind == XFORM_XOR ? KeyedKernel<XformXorOp>(isa) : KeyedKernel<XformAddOp>(isa);
+        return x;
+    }
+
+    static Xform Fixed(XformKind kind, const unsigned char* t) {
+        static const XformIsa isa = XformDetect();
+        Xform x;
+        x.kind = kind;
+        x.table = TableKernel(isa);
+        x.lut = t;
+        return x;
+    }
+
+    XformKind kind;
+    std::vector<unsigned char> key, ks;
+    size_t keyLen, period;
+    KeyedFn keyed;
+    TableFn table;
+    const unsigned char* lut;
+};
+
+#endif